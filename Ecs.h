@@ -0,0 +1,227 @@
+#pragma once
+
+#include "include.h"
+
+// Entities and sparse-set component storage. An Entity is an index plus a generation; the
+// generation is bumped when the index is recycled, so a handle kept past destroy() stops matching
+// instead of silently pointing at whoever got the index next.
+// Each component type lives in a ComponentPool: components packed in one vector, a SparseSet
+// mapping entity index -> slot, and swap-and-pop removal so the vector never has holes. Pools
+// that need their own layout (WaffleStore keeps the hot waffle data as structure-of-arrays for
+// the SIMD kernels) derive from ComponentPoolBase and are attach()ed to the registry instead.
+
+struct Entity { // trivially copyable so it can ride in the lock-free queues
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const Entity&) const = default;
+};
+
+inline constexpr Entity nullEntity{};
+
+// Entity index <-> dense slot. erase() moves the last entity into the freed slot.
+class SparseSet {
+private:
+    static constexpr uint32_t noSlot = UINT32_MAX;
+
+    std::vector<uint32_t> sparse; // entity index -> slot
+    std::vector<Entity> dense;    // slot -> entity
+
+public:
+    size_t size() const { return dense.size(); }
+    bool empty() const { return dense.empty(); }
+
+    bool contains(Entity e) const {
+        return e.index < sparse.size() && sparse[e.index] != noSlot && dense[sparse[e.index]] == e;
+    }
+
+    // e must be contained
+    uint32_t slotOf(Entity e) const { return sparse[e.index]; }
+    Entity entityAt(size_t slot) const { return dense[slot]; }
+    const std::vector<Entity>& entities() const { return dense; }
+
+    // e must not be contained, returns its slot (always the last one)
+    uint32_t insert(Entity e) {
+        if (e.index >= sparse.size()) sparse.resize(size_t(e.index) + 1, noSlot);
+        sparse[e.index] = static_cast<uint32_t>(dense.size());
+        dense.push_back(e);
+        return sparse[e.index];
+    }
+
+    // e must be contained, returns the slot it left; the former last entity now sits there
+    uint32_t erase(Entity e) {
+        uint32_t slot = sparse[e.index];
+        Entity last = dense.back();
+        dense[slot] = last;
+        sparse[last.index] = slot;
+        dense.pop_back();
+        sparse[e.index] = noSlot;
+        return slot;
+    }
+
+    void clear() {
+        sparse.clear();
+        dense.clear();
+    }
+};
+
+class ComponentPoolBase {
+public:
+    virtual ~ComponentPoolBase() = default;
+    virtual bool has(Entity e) const = 0;
+    virtual void remove(Entity e) = 0; // no-op if e has no component here
+};
+
+template <typename T>
+class ComponentPool : public ComponentPoolBase {
+private:
+    SparseSet set;
+    std::vector<T> data; // data[slot] belongs to set.entityAt(slot)
+
+public:
+    size_t size() const { return data.size(); }
+    bool has(Entity e) const override { return set.contains(e); }
+    const std::vector<Entity>& entities() const { return set.entities(); }
+    T* components() { return data.data(); }
+
+    // replaces the component if e already has one
+    template <typename... Args>
+    T& emplace(Entity e, Args&&... args) {
+        if (set.contains(e)) {
+            T& existing = data[set.slotOf(e)];
+            existing = T{ std::forward<Args>(args)... };
+            return existing;
+        }
+        set.insert(e);
+        return data.emplace_back(T{ std::forward<Args>(args)... });
+    }
+
+    void remove(Entity e) override {
+        if (!set.contains(e)) return;
+        uint32_t slot = set.erase(e);
+        if (slot + 1 != data.size()) data[slot] = std::move(data.back());
+        data.pop_back();
+    }
+
+    T& get(Entity e) { return data[set.slotOf(e)]; }
+    const T& get(Entity e) const { return data[set.slotOf(e)]; }
+    T* tryGet(Entity e) { return set.contains(e) ? &data[set.slotOf(e)] : nullptr; }
+
+    void clear() {
+        set.clear();
+        data.clear();
+    }
+};
+
+class Registry {
+private:
+    std::vector<uint32_t> generations; // per entity index
+    std::vector<uint32_t> freeIndices;
+    size_t living = 0;
+
+    std::vector<ComponentPoolBase*> pools; // by poolId, null until first used
+    std::vector<std::unique_ptr<ComponentPoolBase>> ownedPools;
+
+    static uint32_t nextPoolId() {
+        static std::atomic<uint32_t> next{ 0 };
+        return next++;
+    }
+
+    template <typename Pool>
+    static uint32_t poolId() {
+        static const uint32_t id = nextPoolId();
+        return id;
+    }
+
+    template <typename Pool>
+    ComponentPoolBase*& poolSlot() {
+        uint32_t id = poolId<Pool>();
+        if (id >= pools.size()) pools.resize(size_t(id) + 1, nullptr);
+        return pools[id];
+    }
+
+public:
+    Registry() = default;
+    Registry(const Registry&) = delete;
+    Registry& operator=(const Registry&) = delete;
+
+    Entity create() {
+        ++living;
+        if (!freeIndices.empty()) {
+            uint32_t index = freeIndices.back();
+            freeIndices.pop_back();
+            return { index, generations[index] };
+        }
+        generations.push_back(0);
+        return { static_cast<uint32_t>(generations.size() - 1), 0 };
+    }
+
+    bool alive(Entity e) const {
+        return e.index < generations.size() && generations[e.index] == e.generation;
+    }
+
+    // strips every component, attached pools included, and retires the handle
+    void destroy(Entity e) {
+        if (!alive(e)) return;
+        for (ComponentPoolBase* pool : pools) {
+            if (pool) pool->remove(e);
+        }
+        ++generations[e.index];
+        freeIndices.push_back(e.index);
+        --living;
+    }
+
+    size_t size() const { return living; }
+
+    // registers an externally owned pool, looked up as attached<Pool>() afterwards
+    template <typename Pool>
+    void attach(Pool& pool) {
+        poolSlot<Pool>() = &pool;
+    }
+
+    template <typename T>
+    ComponentPool<T>& pool() {
+        ComponentPoolBase*& slot = poolSlot<ComponentPool<T>>();
+        if (!slot) {
+            ownedPools.push_back(std::make_unique<ComponentPool<T>>());
+            slot = ownedPools.back().get();
+        }
+        return static_cast<ComponentPool<T>&>(*slot);
+    }
+
+    template <typename Pool>
+    Pool& attached() {
+        return static_cast<Pool&>(*poolSlot<Pool>());
+    }
+
+    template <typename T, typename... Args>
+    T& emplace(Entity e, Args&&... args) { return pool<T>().emplace(e, std::forward<Args>(args)...); }
+
+    template <typename T>
+    void remove(Entity e) { pool<T>().remove(e); }
+
+    template <typename T>
+    bool has(Entity e) { return pool<T>().has(e); }
+
+    template <typename T>
+    T& get(Entity e) { return pool<T>().get(e); }
+
+    template <typename T>
+    T* tryGet(Entity e) { return pool<T>().tryGet(e); }
+
+    // fn(Entity, First&, Rest&...) for every entity holding all the components. Walks First's pool
+    // back to front, so fn may remove components from the entity it was handed (swap-and-pop only
+    // moves already visited entities). The pool walked is always First's, whatever the pool sizes,
+    // so a view costs as much as First has entities: put the rarest component first.
+    template <typename First, typename... Rest, typename Fn>
+    void view(Fn&& fn) {
+        ComponentPool<First>& lead = pool<First>();
+        std::tuple<ComponentPool<Rest>&...> others{ pool<Rest>()... };
+        for (size_t k = lead.size(); k-- > 0;) {
+            if (k >= lead.size()) continue; // fn removed more than its own entity
+            Entity e = lead.entities()[k];
+            if (!(std::get<ComponentPool<Rest>&>(others).has(e) && ...)) continue;
+            fn(e, lead.components()[k], std::get<ComponentPool<Rest>&>(others).get(e)...);
+        }
+    }
+};
@@ -0,0 +1,218 @@
+#include "Lockstep.h"
+
+/* loopback transport -------------------------------------------------------------------------------- */
+LoopbackNetwork::LoopbackNetwork(size_t peers, const LoopbackConfig& config) :
+    config(config), endpoints(peers), inboxes(peers), random(config.seed * 2654435761u | 1u) {
+    for (size_t k = 0; k < peers; ++k) {
+        endpoints[k].network = this;
+        endpoints[k].peer = k;
+    }
+}
+
+double LoopbackNetwork::uniform() {
+    // xorshift32, so drops don't depend on the standard library
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return static_cast<double>(random >> 8) / 16777216.0;
+}
+
+void LoopbackNetwork::send(size_t from, const std::vector<uint8_t>& datagram) {
+    for (size_t to = 0; to < endpoints.size(); ++to) {
+        if (to == from) continue;
+        ++sent;
+        if (uniform() < config.loss) {
+            ++dropped;
+            continue;
+        }
+        double arrival = now + config.latency + config.jitter * uniform();
+        inboxes[to].push({ arrival, sequence++, datagram });
+    }
+}
+
+bool LoopbackNetwork::receive(size_t to, std::vector<uint8_t>& datagram) {
+    auto& inbox = inboxes[to];
+    if (inbox.empty() || inbox.top().arrival > now) return false;
+    datagram = inbox.top().bytes;
+    inbox.pop();
+    return true;
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* lockstep session ---------------------------------------------------------------------------------- */
+// Packet, little-endian:
+//   u8 version, u8 player, u8 players
+//   u64 received[players]           how far this peer holds each player's frames, acks ours
+//   u64 checksumTick, u64 checksum  its newest state checksum, checksumTick = UINT64_MAX for none
+//   u64 firstTick, u8 frameCount    then its frames firstTick, firstTick + 1, ...
+//   per frame: u8 commandCount, per command: u8 type | additive << 7, f32 a.x a.y b.x b.y
+const uint8_t lockstepPacketVersion = 1;
+
+LockstepSession::LockstepSession(Simulation& sim, Transport& transport, const LockstepConfig& config) :
+    sim(sim), transport(transport), config(config), tick(sim.stats().tick), peers(config.players) {
+    // nobody can have issued anything for the first inputDelay ticks
+    for (Peer& peer : peers) {
+        for (uint64_t t = tick; t < tick + config.inputDelay; ++t) peer.frames[t];
+        peer.received = tick + config.inputDelay;
+        peer.acked = tick + config.inputDelay;
+    }
+}
+
+void LockstepSession::pushCommand(SimCommand cmd) {
+    cmd.player = config.player;
+    pending.push_back(cmd);
+}
+
+bool LockstepSession::ready() const {
+    return std::all_of(peers.begin(), peers.end(), [&](const Peer& peer) { return peer.received > tick; });
+}
+
+void LockstepSession::compareChecksum(uint64_t at, uint64_t theirs) {
+    auto own = ownChecksums.find(at);
+    if (own == ownChecksums.end()) return; // too old, already dropped from the history
+    ++counters.checksumsCompared;
+    if (own->second != theirs) desync = std::min(desync, at);
+}
+
+bool LockstepSession::step() {
+    if (!ready()) {
+        ++counters.stalls;
+        send(); // a resend may be what the others are missing
+        return false;
+    }
+
+    // close our frame for tick + inputDelay, at most 255 commands, the rest wait for the next one
+    Peer& self = peers[config.player];
+    size_t count = std::min<size_t>(pending.size(), 255);
+    self.frames[tick + config.inputDelay].assign(pending.begin(), pending.begin() + count);
+    pending.erase(pending.begin(), pending.begin() + count);
+    self.received = tick + config.inputDelay + 1;
+
+    // commands run in player order, each player's in the order they were issued
+    for (size_t p = 0; p < peers.size(); ++p) {
+        auto frame = peers[p].frames.find(tick);
+        for (SimCommand cmd : frame->second) {
+            cmd.player = static_cast<uint8_t>(p);
+            sim.pushCommand(cmd);
+        }
+        // ours stay until everyone has acknowledged them
+        if (p != config.player) peers[p].frames.erase(frame);
+    }
+    sim.step();
+
+    uint64_t checksum = sim.checksum();
+    ownChecksums[tick] = checksum;
+    if (ownChecksums.size() > checksumHistory) ownChecksums.erase(ownChecksums.begin());
+    lastChecksumTick = tick;
+    for (size_t p = 0; p < peers.size(); ++p) {
+        auto& theirs = peers[p].checksums;
+        auto it = theirs.find(tick);
+        if (it != theirs.end()) compareChecksum(tick, it->second);
+        theirs.erase(theirs.begin(), theirs.upper_bound(tick));
+    }
+
+    ++tick;
+    send();
+    return true;
+}
+
+void LockstepSession::send() {
+    const Peer& self = peers[config.player];
+    uint64_t first = self.received;
+    for (size_t p = 0; p < peers.size(); ++p) {
+        if (p != config.player) first = std::min(first, peers[p].acked);
+    }
+    uint64_t last = std::min<uint64_t>(self.received, first + maxFramesPerPacket);
+    uint64_t checksum = lastChecksumTick != noTick ? ownChecksums[lastChecksumTick] : 0;
+
+    packet.clear();
+    auto put = [&](const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        packet.insert(packet.end(), p, p + size);
+    };
+    packet.push_back(lockstepPacketVersion);
+    packet.push_back(config.player);
+    packet.push_back(config.players);
+    for (const Peer& peer : peers) put(&peer.received, sizeof(uint64_t));
+    put(&lastChecksumTick, sizeof(uint64_t));
+    put(&checksum, sizeof(uint64_t));
+    put(&first, sizeof(uint64_t));
+    packet.push_back(static_cast<uint8_t>(last - first));
+    for (uint64_t t = first; t < last; ++t) {
+        const std::vector<SimCommand>& frame = self.frames.at(t);
+        packet.push_back(static_cast<uint8_t>(frame.size()));
+        for (const SimCommand& cmd : frame) {
+            packet.push_back(static_cast<uint8_t>(static_cast<uint8_t>(cmd.type) | (cmd.additive ? 0x80 : 0)));
+            put(&cmd.a, sizeof(cmd.a));
+            put(&cmd.b, sizeof(cmd.b));
+        }
+    }
+
+    transport.send(packet);
+    ++counters.packetsSent;
+}
+
+void LockstepSession::poll() {
+    while (transport.receive(packet)) {
+        if (handle(packet)) ++counters.packetsReceived;
+        else ++counters.packetsRejected;
+    }
+}
+
+bool LockstepSession::handle(const std::vector<uint8_t>& datagram) {
+    size_t at = 0;
+    auto take = [&](void* data, size_t size) {
+        if (datagram.size() - at < size) return false;
+        std::memcpy(data, datagram.data() + at, size);
+        at += size;
+        return true;
+    };
+
+    uint8_t version, player, players;
+    if (!take(&version, 1) || !take(&player, 1) || !take(&players, 1)) return false;
+    if (version != lockstepPacketVersion || players != config.players || player >= players || player == config.player) return false;
+
+    std::vector<uint64_t> received(players);
+    uint64_t checksumTick, checksum, first;
+    uint8_t frameCount;
+    if (!take(received.data(), players * sizeof(uint64_t))) return false;
+    if (!take(&checksumTick, 8) || !take(&checksum, 8) || !take(&first, 8) || !take(&frameCount, 1)) return false;
+
+    // parse every frame before touching any state, so a cut-short packet changes nothing
+    std::vector<std::vector<SimCommand>> frames(frameCount);
+    for (auto& frame : frames) {
+        uint8_t commands;
+        if (!take(&commands, 1)) return false;
+        frame.resize(commands);
+        for (SimCommand& cmd : frame) {
+            uint8_t typeByte;
+            if (!take(&typeByte, 1) || !take(&cmd.a, sizeof(cmd.a)) || !take(&cmd.b, sizeof(cmd.b))) return false;
+            cmd.type = static_cast<SimCommandType>(typeByte & 0x7f);
+            cmd.additive = (typeByte & 0x80) != 0;
+            cmd.player = player;
+            if (cmd.type > SimCommandType::ClearWall) return false;
+        }
+    }
+
+    Peer& peer = peers[player];
+    Peer& self = peers[config.player];
+    peer.acked = std::max(peer.acked, received[config.player]);
+    uint64_t everyone = self.received;
+    for (size_t p = 0; p < peers.size(); ++p) {
+        if (p != config.player) everyone = std::min(everyone, peers[p].acked);
+    }
+    self.frames.erase(self.frames.begin(), self.frames.lower_bound(std::min(everyone, tick)));
+
+    for (size_t k = 0; k < frames.size(); ++k) {
+        uint64_t t = first + k;
+        if (t >= peer.received) peer.frames.try_emplace(t, std::move(frames[k]));
+    }
+    while (peer.frames.count(peer.received)) ++peer.received;
+
+    if (checksumTick != noTick) {
+        if (checksumTick < tick) compareChecksum(checksumTick, checksum);
+        else peer.checksums[checksumTick] = checksum;
+    }
+    return true;
+}
+/* --------------------------------------------------------------------------------------------------- */
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "include.h"
+#include "Simulation.h"
+
+// Deterministic lockstep multiplayer. Every peer runs the whole simulation and only the players'
+// commands cross the wire, so traffic depends on how fast people click, not on how many waffles
+// there are. A command issued on tick t runs on every peer at tick t + inputDelay; a peer steps a
+// tick once it holds every player's command frame for it (an empty frame says "nothing this tick")
+// and otherwise waits. After each tick the peers trade Simulation::checksum() values, and a
+// mismatch flags the first tick on which they disagreed.
+//
+// The Simulation must be built with SimConfig::lockstep and driven by step() here, never start()ed,
+// and every peer must start from the same state (same spawns, or the same save).
+
+// Unreliable datagrams between the peers of one match. A datagram can arrive late, out of order,
+// twice or never; LockstepSession resends frames until they are acknowledged.
+class Transport {
+public:
+    virtual ~Transport() = default;
+    virtual void send(const std::vector<uint8_t>& datagram) = 0; // to every other peer
+    virtual bool receive(std::vector<uint8_t>& datagram) = 0;    // false once nothing is waiting
+};
+
+struct LoopbackConfig {
+    double latency = 0.05; // seconds one way
+    double jitter = 0.02;  // up to this much more per datagram, so later ones can overtake
+    double loss = 0.05;    // fraction of datagrams dropped
+    uint32_t seed = 1;
+};
+
+// Every peer of a match in one process, for tests. Time only moves when advance() is called, so a
+// headless run at full speed sees the same delays as a game at 60 Hz, and a seed gives the same
+// drops every run. One thread.
+class LoopbackNetwork {
+private:
+    class Endpoint : public Transport {
+    public:
+        LoopbackNetwork* network = nullptr;
+        size_t peer = 0;
+
+        void send(const std::vector<uint8_t>& datagram) override { network->send(peer, datagram); }
+        bool receive(std::vector<uint8_t>& datagram) override { return network->receive(peer, datagram); }
+    };
+
+    struct InFlight {
+        double arrival;
+        uint64_t sequence; // ties on arrival go out in send order
+        std::vector<uint8_t> bytes;
+
+        bool operator>(const InFlight& other) const {
+            return arrival != other.arrival ? arrival > other.arrival : sequence > other.sequence;
+        }
+    };
+
+    LoopbackConfig config;
+    std::vector<Endpoint> endpoints;
+    std::vector<std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>>> inboxes; // per receiver
+    double now = 0.0;
+    uint64_t sequence = 0;
+    uint32_t random;
+
+    double uniform(); // [0, 1)
+    void send(size_t from, const std::vector<uint8_t>& datagram);
+    bool receive(size_t to, std::vector<uint8_t>& datagram);
+
+public:
+    uint64_t sent = 0;    // datagrams, one per receiver
+    uint64_t dropped = 0;
+
+    LoopbackNetwork(size_t peers, const LoopbackConfig& config);
+    LoopbackNetwork(const LoopbackNetwork&) = delete;
+    LoopbackNetwork& operator=(const LoopbackNetwork&) = delete;
+
+    Transport& endpoint(size_t peer) { return endpoints[peer]; }
+    void advance(double seconds) { now += seconds; }
+};
+
+struct LockstepConfig {
+    uint8_t player = 0;       // this peer, stamped on the commands it issues
+    uint8_t players = 2;      // up to simMaxPlayers
+    uint32_t inputDelay = 6;  // ticks, hides up to 100 ms of round trip at 60 Hz without stalling
+};
+
+struct LockstepStats {
+    uint64_t stalls = 0;          // step() calls that had to wait on someone's frame
+    uint64_t packetsSent = 0;
+    uint64_t packetsReceived = 0;
+    uint64_t packetsRejected = 0; // malformed, or from a player outside the match
+    uint64_t checksumsCompared = 0;
+};
+
+class LockstepSession {
+private:
+    static constexpr uint64_t noTick = UINT64_MAX;
+    static const size_t maxFramesPerPacket = 64;
+    static const size_t checksumHistory = 256; // ticks of our own checksums kept for late reports
+
+    struct Peer {
+        std::map<uint64_t, std::vector<SimCommand>> frames; // ticks not run yet
+        uint64_t received = 0; // every frame of this player before this tick is in
+        uint64_t acked = 0;    // this player has every frame of ours before this tick
+        std::map<uint64_t, uint64_t> checksums; // theirs, for ticks we haven't run yet
+    };
+
+    Simulation& sim;
+    Transport& transport;
+    LockstepConfig config;
+    uint64_t tick;
+    std::vector<Peer> peers;            // by player
+    std::vector<SimCommand> pending;    // ours, not in a frame yet
+    std::map<uint64_t, uint64_t> ownChecksums;
+    uint64_t lastChecksumTick = noTick;
+    uint64_t desync = noTick;
+    LockstepStats counters;
+    std::vector<uint8_t> packet;
+
+    void compareChecksum(uint64_t at, uint64_t theirs);
+    bool handle(const std::vector<uint8_t>& datagram);
+
+public:
+    LockstepSession(Simulation& sim, Transport& transport, const LockstepConfig& config);
+
+    // from this peer's player, runs inputDelay ticks after the current one
+    void pushCommand(SimCommand cmd);
+
+    // reads every datagram that arrived since the last call
+    void poll();
+
+    // every player's frame for the next tick is in
+    bool ready() const;
+
+    // Runs the next tick if ready(), then send()s either way. False when it had to wait.
+    bool step();
+
+    // our frames nobody has acknowledged yet, plus the newest checksum, to every peer
+    void send();
+
+    uint64_t currentTick() const { return tick; }
+    bool desynced() const { return desync != noTick; }
+    uint64_t desyncTick() const { return desync; } // first tick found to differ
+    const LockstepStats& stats() const { return counters; }
+};
@@ -0,0 +1,81 @@
+#include "Profiler.h"
+
+static boost::mutex profileRingsMutex;
+static std::vector<std::unique_ptr<ProfileRing>> profileRings; // index is ProfileRing::threadIndex
+
+ProfileRing& registerProfileRing() {
+    boost::lock_guard<boost::mutex> lock(profileRingsMutex);
+    profileRings.push_back(std::make_unique<ProfileRing>(static_cast<uint32_t>(profileRings.size())));
+    return *profileRings.back();
+}
+
+void profileThreadName(const std::string& name) {
+    ProfileRing& ring = profileThreadRing();
+    boost::lock_guard<boost::mutex> lock(profileRingsMutex);
+    ring.threadName = name;
+}
+
+void ProfileReader::read(std::vector<ProfileEvent>& out) {
+    boost::lock_guard<boost::mutex> lock(profileRingsMutex);
+    cursors.resize(profileRings.size(), 0);
+    for (size_t r = 0; r < profileRings.size(); ++r) {
+        cursors[r] = profileRings[r]->read(cursors[r], out);
+    }
+}
+
+static void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+bool exportChromeTrace(const std::string& path) {
+    std::vector<std::pair<uint32_t, std::string>> threads;
+    std::vector<std::vector<ProfileEvent>> events;
+    {
+        boost::lock_guard<boost::mutex> lock(profileRingsMutex);
+        for (const auto& ring : profileRings) {
+            threads.emplace_back(ring->threadIndex, ring->threadName);
+            events.emplace_back();
+            ring->read(0, events.back());
+        }
+    }
+
+    // timestamps relative to the oldest event so they stay readable
+    uint64_t origin = UINT64_MAX;
+    for (const auto& list : events) {
+        for (const ProfileEvent& e : list) origin = std::min(origin, e.begin);
+    }
+
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&] {
+        if (!first) out << ",\n";
+        first = false;
+    };
+    out << std::fixed << std::setprecision(3);
+    for (size_t t = 0; t < threads.size(); ++t) {
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threads[t].first << ",\"args\":{\"name\":";
+        writeJsonString(out, threads[t].second);
+        out << "}}";
+
+        for (const ProfileEvent& e : events[t]) {
+            separator();
+            out << "{\"name\":";
+            writeJsonString(out, e.zone);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << threads[t].first
+                << ",\"ts\":" << static_cast<double>(e.begin - origin) / 1e3
+                << ",\"dur\":" << static_cast<double>(e.end - e.begin) / 1e3 << "}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "include.h"
+
+// Scoped-zone profiler. PROFILE_ZONE("name") times the rest of the enclosing scope and, on the way
+// out, appends { name, begin, end } to a ring buffer owned by the calling thread, so recording
+// never locks or allocates. The overlay drains new events every frame with a ProfileReader, and
+// exportChromeTrace writes whatever the rings still hold as a chrome://tracing / Perfetto file.
+// Zone names must be string literals, events keep the pointer.
+// Build with WAFFLE_PROFILE=0 to compile every zone out.
+
+#ifndef WAFFLE_PROFILE
+#define WAFFLE_PROFILE 1
+#endif
+
+struct ProfileEvent {
+    const char* zone;
+    uint64_t begin; // steady clock, ns
+    uint64_t end;
+};
+
+const size_t profileRingCapacity = size_t(1) << 14; // events kept per thread, a power of two
+
+// Single writer (the owning thread), any number of readers. A reader copies slots, then re-reads
+// head and drops anything the writer may have lapped in the meantime. The writer fills slot
+// head & mask before it bumps head, so the oldest event in the ring, whose slot that is, may
+// already be half overwritten and is never handed out.
+class ProfileRing {
+private:
+    std::unique_ptr<ProfileEvent[]> events{ new ProfileEvent[profileRingCapacity] };
+    std::atomic<uint64_t> head{ 0 }; // events ever pushed
+
+public:
+    const uint32_t threadIndex;
+    std::string threadName;
+
+    explicit ProfileRing(uint32_t index) : threadIndex(index), threadName("thread " + std::to_string(index)) {}
+
+    void push(const ProfileEvent& event) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        events[h & (profileRingCapacity - 1)] = event;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // appends events [from, head) that are still in the ring, returns the new cursor
+    uint64_t read(uint64_t from, std::vector<ProfileEvent>& out) const {
+        uint64_t h = head.load(std::memory_order_acquire);
+        from = std::max(from, h >= profileRingCapacity ? h + 1 - profileRingCapacity : 0);
+        size_t base = out.size();
+        for (uint64_t k = from; k < h; ++k) {
+            out.push_back(events[k & (profileRingCapacity - 1)]);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire); // the copies above happen before this re-read
+        uint64_t after = head.load(std::memory_order_relaxed);
+        uint64_t oldestSafe = after >= profileRingCapacity ? after + 1 - profileRingCapacity : 0;
+        if (oldestSafe > from) {
+            size_t lapped = static_cast<size_t>(std::min(oldestSafe, h) - from);
+            out.erase(out.begin() + base, out.begin() + base + lapped);
+        }
+        return h;
+    }
+};
+
+inline std::atomic<bool> profilerEnabled{ true };
+
+inline uint64_t profileNow() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// registers the calling thread's ring on first use, rings outlive their threads
+ProfileRing& registerProfileRing();
+
+inline ProfileRing& profileThreadRing() {
+    static thread_local ProfileRing* ring = nullptr;
+    if (!ring) ring = &registerProfileRing();
+    return *ring;
+}
+
+// shown in the overlay and as the thread name in traces
+void profileThreadName(const std::string& name);
+
+class ProfileZone {
+private:
+    const char* zone;
+    uint64_t begin;
+
+public:
+    explicit ProfileZone(const char* name) :
+        zone(profilerEnabled.load(std::memory_order_relaxed) ? name : nullptr),
+        begin(zone ? profileNow() : 0) {}
+
+    ~ProfileZone() {
+        if (zone) profileThreadRing().push({ zone, begin, profileNow() });
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#if WAFFLE_PROFILE
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#endif
+
+// Hands out everything recorded since the previous read(), across all threads.
+class ProfileReader {
+private:
+    std::vector<uint64_t> cursors; // per ring, by threadIndex
+
+public:
+    void read(std::vector<ProfileEvent>& out);
+};
+
+// Writes every event still held by the rings as Chrome trace JSON ("X" events, microseconds).
+bool exportChromeTrace(const std::string& path);
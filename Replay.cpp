@@ -0,0 +1,169 @@
+#include "Replay.h"
+
+#include <boost/interprocess/exceptions.hpp>
+
+// sections a file of each version has
+static size_t saveSectionsIn(uint32_t version) {
+    return version == 1 ? static_cast<size_t>(SaveSection::Selection) : saveSectionCount;
+}
+
+// element size and count of every section, as listed in SaveSection
+static void saveSectionShape(const SaveHeader& header, SaveSection s, uint64_t& elementBytes, uint64_t& count) {
+    switch (s) {
+    case SaveSection::Team:
+    case SaveSection::Flags:
+    case SaveSection::Selection:
+        elementBytes = 1; count = header.waffles; break;
+    case SaveSection::CombatTarget:
+        elementBytes = 4; count = header.waffles; break;
+    case SaveSection::OrderGoal:
+        elementBytes = sizeof(sf::Vector2f); count = header.waffles; break;
+    case SaveSection::PathOffsets:
+        elementBytes = 4; count = uint64_t(header.waffles) + 1; break;
+    case SaveSection::PathPoints:
+        elementBytes = sizeof(sf::Vector2f); count = header.pathPoints; break;
+    case SaveSection::ShotX:
+    case SaveSection::ShotY:
+    case SaveSection::ShotVx:
+    case SaveSection::ShotVy:
+    case SaveSection::ShotLife:
+        elementBytes = 4; count = header.shots; break;
+    case SaveSection::ShotTeam:
+        elementBytes = 1; count = header.shots; break;
+    case SaveSection::WallEdits:
+        elementBytes = sizeof(SaveWallEdit); count = header.wallEdits; break;
+    default: // per-waffle floats
+        elementBytes = 4; count = header.waffles; break;
+    }
+}
+
+bool SaveView::open(const std::string& path) {
+    namespace bip = boost::interprocess;
+    header = nullptr;
+    try {
+        file = bip::file_mapping(path.c_str(), bip::read_only);
+        region = bip::mapped_region(file, bip::read_only);
+    }
+    catch (const bip::interprocess_exception&) {
+        return false; // missing, unreadable or empty
+    }
+
+    size_t size = region.get_size();
+    if (size < sizeof(SaveHeader)) return false;
+    const auto* candidate = static_cast<const SaveHeader*>(region.get_address());
+    if (std::memcmp(candidate->magic, "WAFS", 4) != 0) return false;
+    if (candidate->version == 0 || candidate->version > saveVersion) return false;
+    if (candidate->sectionCount < saveSectionsIn(candidate->version)) return false;
+    if (sizeof(SaveHeader) + uint64_t(candidate->sectionCount) * sizeof(SaveSectionRange) > size) return false;
+
+    const auto* table = reinterpret_cast<const SaveSectionRange*>(candidate + 1);
+    for (size_t s = 0; s < std::min<size_t>(candidate->sectionCount, saveSectionCount); ++s) {
+        uint64_t elementBytes, count;
+        saveSectionShape(*candidate, static_cast<SaveSection>(s), elementBytes, count);
+        const SaveSectionRange& range = table[s];
+        if (range.bytes != elementBytes * count) return false;
+        if (range.offset % 16 != 0 || range.offset > size || range.bytes > size - range.offset) return false;
+    }
+
+    // path offsets must stay inside the point section, or load() would read past it
+    const uint32_t* offsets = reinterpret_cast<const uint32_t*>(
+        static_cast<const char*>(region.get_address()) + table[static_cast<size_t>(SaveSection::PathOffsets)].offset);
+    for (uint32_t i = 0; i < candidate->waffles; ++i) {
+        if (offsets[i] > offsets[i + 1]) return false;
+    }
+    if (offsets[0] != 0 || offsets[candidate->waffles] != candidate->pathPoints) return false;
+
+    header = candidate;
+    return true;
+}
+
+bool CommandLog::write(const std::string& path) const {
+    std::vector<char> bytes;
+    bytes.reserve(sizeof(CommandLogHeader) + commands.size() * 10);
+    auto put = [&](const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        bytes.insert(bytes.end(), p, p + size);
+    };
+
+    CommandLogHeader header{ { 'W', 'A', 'F', 'L' }, commandLogVersion, startTick, endTick, commands.size() };
+    put(&header, sizeof(header));
+
+    uint64_t previous = startTick;
+    for (const LoggedCommand& entry : commands) {
+        uint64_t delta = entry.tick - previous;
+        previous = entry.tick;
+        do {
+            uint8_t byte = static_cast<uint8_t>(delta & 0x7f);
+            delta >>= 7;
+            if (delta != 0) byte |= 0x80;
+            bytes.push_back(static_cast<char>(byte));
+        } while (delta != 0);
+
+        const SimCommand& cmd = entry.command;
+        bytes.push_back(static_cast<char>(static_cast<uint8_t>(cmd.type) | (cmd.additive ? 0x80 : 0) | (cmd.player ? 0x40 : 0)));
+        if (cmd.player) bytes.push_back(static_cast<char>(cmd.player));
+        put(&cmd.a, sizeof(cmd.a));
+        if (cmd.type == SimCommandType::Select) put(&cmd.b, sizeof(cmd.b));
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(out);
+}
+
+bool CommandLog::read(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    CommandLogHeader header;
+    if (bytes.size() < sizeof(header)) return false;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::memcmp(header.magic, "WAFL", 4) != 0) return false;
+    if (header.version == 0 || header.version > commandLogVersion) return false;
+
+    std::vector<LoggedCommand> parsed;
+    parsed.reserve(static_cast<size_t>(std::min<uint64_t>(header.count, bytes.size())));
+    size_t at = sizeof(header);
+    auto take = [&](void* data, size_t size) {
+        if (bytes.size() - at < size) return false;
+        std::memcpy(data, bytes.data() + at, size);
+        at += size;
+        return true;
+    };
+
+    uint64_t tick = header.startTick;
+    for (uint64_t n = 0; n < header.count; ++n) {
+        uint64_t delta = 0;
+        uint8_t byte;
+        int shift = 0;
+        do {
+            if (shift > 63 || !take(&byte, 1)) return false;
+            delta |= uint64_t(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        tick += delta;
+
+        uint8_t typeByte;
+        SimCommand cmd{};
+        if (!take(&typeByte, 1)) return false;
+        if ((typeByte & 0x40) && !take(&cmd.player, 1)) return false;
+        if (!take(&cmd.a, sizeof(cmd.a))) return false;
+        cmd.type = static_cast<SimCommandType>(typeByte & 0x3f);
+        cmd.additive = (typeByte & 0x80) != 0;
+        if (cmd.type > SimCommandType::ClearWall) return false;
+        if (cmd.type == SimCommandType::Select) {
+            if (!take(&cmd.b, sizeof(cmd.b))) return false;
+        }
+        else {
+            cmd.b = cmd.a;
+        }
+        parsed.push_back({ tick, cmd });
+    }
+
+    startTick = header.startTick;
+    endTick = header.endTick;
+    commands = std::move(parsed);
+    return true;
+}
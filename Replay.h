@@ -0,0 +1,137 @@
+#pragma once
+
+#include "include.h"
+#include "Simulation.h"
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// Captures of a running game: a save file with the waffle state at one tick, plus a log of every
+// command the simulation ran after it. Loading the save into a fresh Simulation and pushing the
+// logged commands back at their ticks replays the capture, the same way on every run when paths
+// run inline, so a bad frame seen in the game can be profiled offline.
+//
+// Save (.wsave): a SaveHeader, its section table, then one packed array per section, each starting
+// on a 16-byte boundary. Sections are plain little-endian arrays (x positions, path points, ...),
+// so SaveView hands out pointers straight into the mapped file and nothing is parsed.
+// Command log (.wlog): a CommandLogHeader, then one record per command: the ticks since the
+// previous record as a varint, the type with the additive flag in its top bit and a
+// player-follows flag below it, the player if that is set, and the order's points, b only for
+// Select. A move order from player 0 takes 10 bytes.
+//
+// Readers take every version up to their own. A version adds sections at the end of the table,
+// so an older file just lacks them.
+
+const uint32_t saveVersion = 2;       // 2: per-player Selection section
+const uint32_t commandLogVersion = 2; // 2: player byte
+
+enum class SaveSection : uint32_t {
+    X, Y,             // float per waffle
+    TargetX, TargetY, // float per waffle
+    Team,             // uint8_t per waffle
+    Flags,            // uint8_t per waffle, saveEnRoute (and saveSelected in version 1)
+    Health,           // float per waffle
+    Cooldown,         // float per waffle, seconds until the weapon is ready
+    CombatTarget,     // uint32_t per waffle, save index of its target or UINT32_MAX
+    OrderGoal,        // sf::Vector2f per waffle, where its last move order sent it
+    PathOffsets,      // uint32_t per waffle plus one, waffle i's path is [offsets[i], offsets[i + 1])
+    PathPoints,       // sf::Vector2f per path point
+    ShotX, ShotY, ShotVx, ShotVy, ShotLife, // float per projectile
+    ShotTeam,         // uint8_t per projectile
+    WallEdits,        // SaveWallEdit per runtime wall edit
+    Selection,        // uint8_t per waffle, bit p for player p, since version 2
+    Count,
+};
+
+const size_t saveSectionCount = static_cast<size_t>(SaveSection::Count);
+
+const uint8_t saveSelected = 1; // version 1, selected by player 0
+const uint8_t saveEnRoute = 2; // waiting on a path or following a flow field, asks for a path on load
+
+struct SaveSectionRange {
+    uint64_t offset; // from the start of the file
+    uint64_t bytes;
+};
+
+struct SaveHeader {
+    char magic[4];          // "WAFS"
+    uint32_t version;
+    uint64_t tick;          // ticks the simulation had run when it was saved
+    uint32_t waffles;
+    uint32_t pathPoints;
+    uint32_t shots;
+    uint32_t wallEdits;
+    uint32_t sectionCount;  // SaveSectionRange entries right after the header
+    uint32_t reserved;
+};
+
+struct SaveWallEdit {
+    int32_t gx, gy;
+    uint32_t wall;
+};
+
+// Read-only mapping of a save file. Valid until the view is reopened or destroyed.
+class SaveView {
+private:
+    boost::interprocess::file_mapping file;
+    boost::interprocess::mapped_region region;
+    const SaveHeader* header = nullptr;
+
+    const SaveSectionRange* ranges() const { return reinterpret_cast<const SaveSectionRange*>(header + 1); }
+
+public:
+    // false if the file can't be mapped, isn't a save, comes from a newer version or has a
+    // section that doesn't fit
+    bool open(const std::string& path);
+
+    uint32_t version() const { return header->version; }
+    bool has(SaveSection s) const { return static_cast<size_t>(s) < header->sectionCount; }
+    uint64_t tick() const { return header->tick; }
+    uint32_t waffles() const { return header->waffles; }
+    uint32_t pathPoints() const { return header->pathPoints; }
+    uint32_t shots() const { return header->shots; }
+    uint32_t wallEdits() const { return header->wallEdits; }
+
+    // points into the mapping, T must match the element type listed in SaveSection. s must be has()
+    template <typename T>
+    const T* section(SaveSection s) const {
+        const SaveSectionRange& range = ranges()[static_cast<size_t>(s)];
+        return reinterpret_cast<const T*>(static_cast<const char*>(region.get_address()) + range.offset);
+    }
+};
+
+struct CommandLogHeader {
+    char magic[4];       // "WAFL"
+    uint32_t version;
+    uint64_t startTick;  // tick of the save the log starts from
+    uint64_t endTick;    // tick recording stopped at
+    uint64_t count;      // records that follow
+};
+
+struct LoggedCommand {
+    uint64_t tick; // absolute, the tick whose commandSystem ran it
+    SimCommand command;
+};
+
+// Commands in the order the simulation ran them. Filled by Simulation::recordCommands.
+class CommandLog {
+public:
+    uint64_t startTick = 0;
+    uint64_t endTick = 0;
+    std::vector<LoggedCommand> commands;
+
+    void begin(uint64_t tick) {
+        startTick = endTick = tick;
+        commands.clear();
+    }
+
+    void append(uint64_t tick, const SimCommand& cmd) {
+        commands.push_back({ tick, cmd });
+        endTick = std::max(endTick, tick + 1);
+    }
+
+    void end(uint64_t tick) { endTick = std::max(endTick, tick); }
+
+    bool write(const std::string& path) const;
+    bool read(const std::string& path); // false if the file is missing, isn't a log or is cut short
+};
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "Simulation.h"
+#include "Replay.h"
+
+// Scripted runs for the headless driver and the benchmarks. A scenario spawns a seeded square of
+// waffles and pushes a fixed list of orders at fixed ticks, so the same scenario always does the
+// same work and, with SimConfig::inlinePaths, ends in the same state.
+
+struct ScenarioOrder {
+    uint64_t tick;
+    SimCommand command;
+};
+
+struct Scenario {
+    std::string name;
+    size_t waffles = 100;
+    uint32_t seed = 1;
+    uint64_t ticks = 600;
+    std::vector<sf::Vector2f> spawns;
+    std::vector<uint8_t> teams;        // per spawn, empty puts everyone on team 0
+    std::vector<ScenarioOrder> orders; // sorted by tick
+};
+
+// small LCG so scenarios don't depend on the standard library's distributions
+class ScenarioRandom {
+private:
+    uint32_t state;
+
+public:
+    explicit ScenarioRandom(uint32_t seed) : state(seed * 2654435761u + 1u) {}
+
+    uint32_t next() {
+        state = state * 1664525u + 1013904223u;
+        return state;
+    }
+
+    float uniform(float lo, float hi) {
+        return lo + (hi - lo) * static_cast<float>(next() >> 8) / 16777216.f;
+    }
+};
+
+// spawn points on free cells spread over a square big enough that waffles don't start stacked
+inline std::vector<sf::Vector2f> scenarioSpawns(size_t waffles, ScenarioRandom& random, float& halfSide) {
+    halfSide = std::sqrt(static_cast<float>(waffles)) * 60.f;
+    std::vector<sf::Vector2f> spawns;
+    spawns.reserve(waffles);
+    while (spawns.size() < waffles) {
+        sf::Vector2f pos(random.uniform(-halfSide, halfSide), random.uniform(-halfSide, halfSide));
+        if (isWall(static_cast<int>(std::floor(pos.x / gridSize)), static_cast<int>(std::floor(pos.y / gridSize)))) continue;
+        spawns.push_back(pos);
+    }
+    return spawns;
+}
+
+// Group orders: everyone marches to one point, the western half of the crowd splits off to a
+// second point, then everyone regroups on a third. Exercises flow fields, collisions and
+// crowding at the goal.
+inline Scenario makeMarchScenario(size_t waffles, uint32_t seed, uint64_t ticks) {
+    ScenarioRandom random(seed);
+    Scenario scenario{ "march", waffles, seed, ticks, {}, {}, {} };
+    float halfSide;
+    scenario.spawns = scenarioSpawns(waffles, random, halfSide);
+
+    float reach = halfSide + 3000.f;
+    sf::Vector2f everything(halfSide + 1e5f, halfSide + 1e5f);
+    auto order = [&](uint64_t tick, SimCommandType type, sf::Vector2f a, sf::Vector2f b) {
+        scenario.orders.push_back({ tick, { type, false, a, b } });
+    };
+
+    sf::Vector2f first(random.uniform(-reach, reach), random.uniform(-reach, reach));
+    order(1, SimCommandType::Select, -everything, everything);
+    order(1, SimCommandType::Move, first, first);
+
+    sf::Vector2f second(random.uniform(-reach, reach), random.uniform(-reach, reach));
+    order(ticks / 3, SimCommandType::Select, -everything, sf::Vector2f(first.x, everything.y));
+    order(ticks / 3, SimCommandType::Move, second, second);
+
+    sf::Vector2f third(random.uniform(-reach, reach), random.uniform(-reach, reach));
+    order(2 * ticks / 3, SimCommandType::Select, -everything, everything);
+    order(2 * ticks / 3, SimCommandType::Move, third, third);
+    return scenario;
+}
+
+// Single-unit orders: waves of click-selected waffles each sent somewhere of their own, so every
+// order is an A* (or HPA*) search. Exercises the path workers and the path cache.
+inline Scenario makeScatterScenario(size_t waffles, uint32_t seed, uint64_t ticks) {
+    ScenarioRandom random(seed);
+    Scenario scenario{ "scatter", waffles, seed, ticks, {}, {}, {} };
+    float halfSide;
+    scenario.spawns = scenarioSpawns(waffles, random, halfSide);
+
+    const size_t perWave = std::min<size_t>(waffles, 256);
+    float reach = halfSide + 4000.f;
+    for (uint64_t tick : { uint64_t(1), ticks / 2 }) {
+        for (size_t k = 0; k < perWave; ++k) {
+            // spawns are only exact on the first wave, later clicks pick whoever is nearby
+            sf::Vector2f pick = scenario.spawns[random.next() % waffles];
+            sf::Vector2f goal(random.uniform(-reach, reach), random.uniform(-reach, reach));
+            scenario.orders.push_back({ tick, { SimCommandType::Select, false, pick, pick } });
+            scenario.orders.push_back({ tick, { SimCommandType::Move, false, goal, goal } });
+        }
+    }
+    return scenario;
+}
+
+// Two armies, west (team 0) and east (team 1) of x = 0, trading volleys every volleyTicks until
+// the end. Every waffle fires each volley, so thousands of shots are in flight at once.
+// Exercises the projectile pool, swept hits through the grid and removing waffles mid-run.
+inline Scenario makeVolleyScenario(size_t waffles, uint32_t seed, uint64_t ticks) {
+    ScenarioRandom random(seed);
+    Scenario scenario{ "volley", waffles, seed, ticks, {}, {}, {} };
+    float halfSide;
+    scenario.spawns = scenarioSpawns(waffles, random, halfSide);
+    for (const sf::Vector2f& pos : scenario.spawns) {
+        scenario.teams.push_back(pos.x < 0.f ? 0 : 1);
+    }
+
+    const uint64_t volleyTicks = 20;
+    sf::Vector2f everything(halfSide + 1e5f, halfSide + 1e5f);
+    for (uint64_t tick = 1; tick < ticks; tick += volleyTicks) {
+        // aim a little off centre each volley so the shots spread over the other army
+        sf::Vector2f westAim(halfSide * 0.5f, random.uniform(-halfSide, halfSide) * 0.5f);
+        sf::Vector2f eastAim(-halfSide * 0.5f, random.uniform(-halfSide, halfSide) * 0.5f);
+        scenario.orders.push_back({ tick, { SimCommandType::Select, false, -everything, sf::Vector2f(0.f, everything.y) } });
+        scenario.orders.push_back({ tick, { SimCommandType::Fire, false, westAim, westAim } });
+        scenario.orders.push_back({ tick, { SimCommandType::Select, false, sf::Vector2f(0.f, -everything.y), everything } });
+        scenario.orders.push_back({ tick, { SimCommandType::Fire, false, eastAim, eastAim } });
+    }
+    return scenario;
+}
+
+// Single-unit orders east across a wall that goes up while the waffles walk: a wave of
+// click-selected waffles heads for goals of their own, a wall line is built across their way at
+// a fifth of the run and a gap is opened in its middle at half time. Exercises the incremental
+// path repair on blocked routes and shoved units.
+inline Scenario makeDetourScenario(size_t waffles, uint32_t seed, uint64_t ticks) {
+    ScenarioRandom random(seed);
+    Scenario scenario{ "detour", waffles, seed, ticks, {}, {}, {} };
+    float halfSide;
+    scenario.spawns = scenarioSpawns(waffles, random, halfSide);
+
+    const size_t perWave = std::min<size_t>(waffles, 256);
+    float goalX = halfSide + 4000.f;
+    for (size_t k = 0; k < perWave; ++k) {
+        sf::Vector2f pick = scenario.spawns[random.next() % waffles];
+        sf::Vector2f goal(random.uniform(goalX, goalX + 2000.f), random.uniform(-halfSide, halfSide));
+        scenario.orders.push_back({ 1, { SimCommandType::Select, false, pick, pick } });
+        scenario.orders.push_back({ 1, { SimCommandType::Move, false, goal, goal } });
+    }
+
+    int wallGx = static_cast<int>(std::floor((halfSide + 2000.f) / gridSize));
+    int minGy = static_cast<int>(std::floor((-halfSide - 1000.f) / gridSize));
+    int maxGy = static_cast<int>(std::floor((halfSide + 1000.f) / gridSize));
+    for (int gy = minGy; gy <= maxGy; ++gy) {
+        sf::Vector2f cell((wallGx + 0.5f) * gridSize, (gy + 0.5f) * gridSize);
+        scenario.orders.push_back({ ticks / 5, { SimCommandType::BuildWall, false, cell, cell } });
+        if (std::abs(gy - (minGy + maxGy) / 2) <= 1) {
+            scenario.orders.push_back({ ticks / 2, { SimCommandType::ClearWall, false, cell, cell } });
+        }
+    }
+    std::stable_sort(scenario.orders.begin(), scenario.orders.end(),
+        [](const ScenarioOrder& a, const ScenarioOrder& b) { return a.tick < b.tick; });
+    return scenario;
+}
+
+// Group orders that wall off their own goal: every quarter of the run the whole crowd is sent to
+// a new point and, on the same tick, a short wall line goes up across its way just short of the
+// goal while the previous one comes down. The walls land on the tick the order's flow field and
+// formation are planned, so a lockstep match of it checks that every peer sees them in the same
+// order.
+inline Scenario makeBarricadeScenario(size_t waffles, uint32_t seed, uint64_t ticks) {
+    ScenarioRandom random(seed);
+    Scenario scenario{ "barricade", waffles, seed, ticks, {}, {}, {} };
+    float halfSide;
+    scenario.spawns = scenarioSpawns(waffles, random, halfSide);
+
+    float reach = halfSide + 3000.f;
+    sf::Vector2f everything(halfSide + 1e5f, halfSide + 1e5f);
+    std::vector<sf::Vector2f> previous;
+    const uint64_t every = std::max<uint64_t>(ticks / 4, 1);
+    for (uint64_t tick = 1; tick < ticks; tick += every) {
+        sf::Vector2f goal(random.uniform(-reach, reach), random.uniform(-reach, reach));
+        scenario.orders.push_back({ tick, { SimCommandType::Select, false, -everything, everything } });
+        scenario.orders.push_back({ tick, { SimCommandType::Move, false, goal, goal } });
+
+        for (const sf::Vector2f& cell : previous) {
+            scenario.orders.push_back({ tick, { SimCommandType::ClearWall, false, cell, cell } });
+        }
+        previous.clear();
+
+        // seven cells across the line from the crowd's centre, three cells short of the goal
+        float length = std::max(std::sqrt(goal.x * goal.x + goal.y * goal.y), 1.f);
+        sf::Vector2f forward = goal / length;
+        sf::Vector2f side(-forward.y, forward.x);
+        sf::Vector2f middle = goal - forward * (3.f * gridSize);
+        for (int k = -3; k <= 3; ++k) {
+            sf::Vector2f cell = middle + side * (k * gridSize);
+            scenario.orders.push_back({ tick, { SimCommandType::BuildWall, false, cell, cell } });
+            previous.push_back(cell);
+        }
+    }
+    return scenario;
+}
+
+inline bool makeScenario(const std::string& name, size_t waffles, uint32_t seed, uint64_t ticks, Scenario& out) {
+    if (name == "march") out = makeMarchScenario(waffles, seed, ticks);
+    else if (name == "scatter") out = makeScatterScenario(waffles, seed, ticks);
+    else if (name == "volley") out = makeVolleyScenario(waffles, seed, ticks);
+    else if (name == "detour") out = makeDetourScenario(waffles, seed, ticks);
+    else if (name == "barricade") out = makeBarricadeScenario(waffles, seed, ticks);
+    else return false;
+    return true;
+}
+
+inline void spawnScenario(Simulation& sim, const Scenario& scenario) {
+    for (size_t i = 0; i < scenario.spawns.size(); ++i) {
+        sim.addWaffle(scenario.spawns[i], scenario.teams.empty() ? 0 : scenario.teams[i]);
+    }
+}
+
+// pushes every order due at `tick`, next is the index of the first order not pushed yet
+inline void pushScenarioOrders(Simulation& sim, const Scenario& scenario, uint64_t tick, size_t& next) {
+    while (next < scenario.orders.size() && scenario.orders[next].tick <= tick) {
+        sim.pushCommand(scenario.orders[next].command);
+        ++next;
+    }
+}
+
+// A capture as a scenario: the save at <base>.wsave is loaded into sim, the orders are the commands
+// of <base>.wlog with their ticks counted from the save, and it runs as long as the recording did.
+// False if either file can't be read or they come from different captures.
+inline bool loadCapture(Simulation& sim, const std::string& base, Scenario& out) {
+    SaveView save;
+    CommandLog log;
+    if (!save.open(base + ".wsave") || !log.read(base + ".wlog")) return false;
+    if (log.startTick != save.tick()) return false;
+
+    sim.load(save);
+    out = Scenario{ "replay", save.waffles(), 0, log.endTick - log.startTick, {}, {}, {} };
+    for (const LoggedCommand& entry : log.commands) {
+        out.orders.push_back({ entry.tick - log.startTick, entry.command });
+    }
+    return true;
+}
+
+// FNV-1a over the bits of every waffle position
+inline uint64_t snapshotChecksum(const WaffleSnapshot& snapshot) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const sf::Vector2f& pos : snapshot.positions) {
+        uint32_t bits[2];
+        std::memcpy(bits, &pos, sizeof(bits));
+        for (uint32_t word : bits) {
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
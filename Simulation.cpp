@@ -0,0 +1,4113 @@
+﻿#include "Simulation.h"
+#include "Profiler.h"
+#include "Replay.h"
+
+// Lockstep peers (Lockstep.h) must agree on every bit of every tick, so the simulation sticks to
+// IEEE floats at float precision: the kernels only use correctly rounded operations (add, mul,
+// div, sqrt, no rsqrt or trig), in the same order on the SIMD and scalar paths, and the build
+// keeps the compiler from fusing them into FMAs (CMakeLists.txt).
+static_assert(std::numeric_limits<float>::is_iec559, "the simulation needs IEEE 754 floats");
+#if defined(__FAST_MATH__) || defined(_M_FP_FAST)
+#error "fast-math reorders float operations, lockstep peers would drift apart"
+#endif
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+#error "floats must be evaluated at float precision (SSE2, not x87) for lockstep"
+#endif
+
+class FlowField;
+
+// Waffle component pool, stored as structure-of-arrays. The per-tick movement and collision
+// kernels only stream the hot arrays (positions, targets, grid cells). Slots are dense like any
+// other pool: removing a waffle moves the last one into its slot, so code that keeps a waffle
+// across ticks holds its Entity and looks the slot up again.
+// Paths share one flat pool instead of a deque per waffle: slot i follows
+// pathPool[pathBegin[i], pathEnd[i]), and setPath appends to the pool, compacting it once most of
+// it is consumed or replaced.
+struct WaffleStore : ComponentPoolBase {
+    SparseSet set;
+
+    // hot
+    std::vector<float> x, y;
+    std::vector<float> targetX, targetY;
+    std::vector<int> gridX, gridY;
+    std::vector<uint8_t> team; // read by every projectile hit test
+    std::vector<uint8_t> coarse; // moved by the level-of-detail pass, skipped by the kernels
+
+    // cold
+    std::vector<uint8_t> selected; // bit p for player p
+    std::vector<uint32_t> pathSerial; // bumped per move order so late async paths are ignored
+    std::vector<sf::Vector2f> orderGoal; // where the last move order sent the waffle
+    std::vector<uint8_t> pathPending;    // a path or flow field was asked for and hasn't arrived
+    std::vector<uint8_t> coarseOwed;     // ticks a coarse waffle hasn't moved for yet
+
+    std::vector<uint32_t> pathBegin, pathEnd;
+    std::vector<sf::Vector2f> pathPool; // world positions of path nodes
+    std::vector<sf::Vector2f> pathScratch;
+    size_t pathLive = 0; // pool entries still referenced
+
+    size_t size() const { return x.size(); }
+
+    bool has(Entity e) const override { return set.contains(e); }
+    size_t slotOf(Entity e) const { return set.slotOf(e); }
+    Entity entityAt(size_t i) const { return set.entityAt(i); }
+
+    sf::Vector2f pos(size_t i) const { return { x[i], y[i] }; }
+    void setPos(size_t i, sf::Vector2f p) { x[i] = p.x; y[i] = p.y; }
+    sf::Vector2f target(size_t i) const { return { targetX[i], targetY[i] }; }
+    void setTarget(size_t i, sf::Vector2f p) { targetX[i] = p.x; targetY[i] = p.y; }
+
+    size_t add(Entity e, sf::Vector2f position, uint8_t waffleTeam) {
+        set.insert(e);
+        x.push_back(position.x);
+        y.push_back(position.y);
+        targetX.push_back(position.x);
+        targetY.push_back(position.y);
+        gridX.push_back(static_cast<int>(std::floor(position.x / gridSize)));
+        gridY.push_back(static_cast<int>(std::floor(position.y / gridSize)));
+        team.push_back(waffleTeam);
+        coarse.push_back(0);
+        selected.push_back(false);
+        pathSerial.push_back(0);
+        orderGoal.push_back(position);
+        pathPending.push_back(0);
+        coarseOwed.push_back(0);
+        pathBegin.push_back(0);
+        pathEnd.push_back(0);
+        return size() - 1;
+    }
+
+    void remove(Entity e) override {
+        if (!set.contains(e)) return;
+        clearPath(set.slotOf(e));
+        size_t i = set.erase(e);
+        auto swapPop = [i](auto& column) {
+            column[i] = column.back();
+            column.pop_back();
+        };
+        swapPop(x);
+        swapPop(y);
+        swapPop(targetX);
+        swapPop(targetY);
+        swapPop(gridX);
+        swapPop(gridY);
+        swapPop(team);
+        swapPop(coarse);
+        swapPop(selected);
+        swapPop(pathSerial);
+        swapPop(orderGoal);
+        swapPop(pathPending);
+        swapPop(coarseOwed);
+        swapPop(pathBegin);
+        swapPop(pathEnd);
+    }
+
+    bool hasPath(size_t i) const { return pathBegin[i] != pathEnd[i]; }
+    size_t pathLength(size_t i) const { return pathEnd[i] - pathBegin[i]; }
+    const sf::Vector2f* pathData(size_t i) const { return pathPool.data() + pathBegin[i]; }
+    sf::Vector2f pathFront(size_t i) const { return pathPool[pathBegin[i]]; }
+
+    void popPathFront(size_t i) {
+        ++pathBegin[i];
+        --pathLive;
+    }
+
+    void clearPath(size_t i) {
+        pathLive -= pathLength(i);
+        pathBegin[i] = pathEnd[i] = 0;
+    }
+
+    template <typename It>
+    void setPath(size_t i, It first, It last) {
+        clearPath(i);
+        if (pathPool.size() > 1024 && pathPool.size() > 2 * pathLive) compactPaths();
+
+        pathBegin[i] = static_cast<uint32_t>(pathPool.size());
+        pathPool.insert(pathPool.end(), first, last);
+        pathEnd[i] = static_cast<uint32_t>(pathPool.size());
+        pathLive += pathLength(i);
+    }
+
+    void compactPaths() {
+        pathScratch.clear();
+        for (size_t i = 0; i < size(); ++i) {
+            uint32_t begin = static_cast<uint32_t>(pathScratch.size());
+            pathScratch.insert(pathScratch.end(), pathPool.begin() + pathBegin[i], pathPool.begin() + pathEnd[i]);
+            pathBegin[i] = begin;
+            pathEnd[i] = static_cast<uint32_t>(pathScratch.size());
+        }
+        std::swap(pathPool, pathScratch);
+    }
+};
+
+
+// If goal = wall, pick nearby non-wall (within radius 3). Returns false if there is none.
+static bool resolveGoalCell(int& goalGx, int& goalGy) {
+    if (!isWall(goalGx, goalGy)) return true;
+
+    for (int r = 1; r <= 3; ++r) {
+        for (int dx = -r; dx <= r; ++dx) {
+            for (int dy = -r; dy <= r; ++dy) {
+                int gx = goalGx + dx;
+                int gy = goalGy + dy;
+                if (!isWall(gx, gy)) {
+                    goalGx = gx;
+                    goalGy = gy;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Reusable A* state, one per thread. Nodes live in a pool indexed through an open-addressing
+// table whose slots are stamped with a search generation, so a new search just bumps the
+// generation instead of clearing anything. The open set is a binary heap of node indices with
+// a back-pointer per node for decrease-key. Once the arrays have grown, searches don't allocate.
+const uint32_t maxSearchNodes = 1u << 18; // give up rather than flood an unreachable goal
+const int jpsMaxJump = 256; // long jumps stop early, any cell is a valid jump point
+
+enum class PathSearchMode : uint8_t {
+    AStar,     // expand all 8 neighbours
+    JumpPoint, // Jump Point Search, same path costs with far fewer expansions
+};
+// read by the path workers on every search
+std::atomic<PathSearchMode> pathSearchMode{ PathSearchMode::JumpPoint };
+
+class AstarContext {
+private:
+    static constexpr uint32_t noNode = UINT32_MAX;
+
+    struct SearchNode {
+        int gx, gy;
+        float g;
+        float f;
+        uint32_t parent;    // node index, noNode for the start
+        uint32_t heapIndex; // position in heap, noNode once closed
+    };
+
+    std::vector<SearchNode> nodes;
+    std::vector<uint32_t> heap;
+    std::vector<uint32_t> slotNode;
+    std::vector<uint32_t> slotStamp; // slot is empty unless it matches generation
+    uint32_t slotMask = 0;
+    uint32_t generation = 0;
+    uint32_t goalNode = noNode;
+
+    static uint32_t hashCell(int gx, int gy) {
+        uint32_t h = static_cast<uint32_t>(gx) * 0x9E3779B1u ^ static_cast<uint32_t>(gy) * 0x85EBCA77u;
+        return h ^ (h >> 15);
+    }
+
+    void insertSlot(uint32_t node) {
+        uint32_t slot = hashCell(nodes[node].gx, nodes[node].gy) & slotMask;
+        while (slotStamp[slot] == generation) slot = (slot + 1) & slotMask;
+        slotStamp[slot] = generation;
+        slotNode[slot] = node;
+    }
+
+    void growTable() {
+        size_t size = slotStamp.empty() ? 4096 : slotStamp.size() * 2;
+        slotNode.assign(size, 0);
+        slotStamp.assign(size, 0);
+        slotMask = static_cast<uint32_t>(size - 1);
+        for (uint32_t n = 0; n < nodes.size(); ++n) insertSlot(n);
+    }
+
+    // node index for the cell, creating it (g = infinity) if this search hasn't seen it
+    uint32_t nodeAt(int gx, int gy) {
+        uint32_t slot = hashCell(gx, gy) & slotMask;
+        while (slotStamp[slot] == generation) {
+            const SearchNode& n = nodes[slotNode[slot]];
+            if (n.gx == gx && n.gy == gy) return slotNode[slot];
+            slot = (slot + 1) & slotMask;
+        }
+
+        uint32_t node = static_cast<uint32_t>(nodes.size());
+        nodes.push_back({ gx, gy, std::numeric_limits<float>::infinity(), 0.f, noNode, noNode });
+        slotStamp[slot] = generation;
+        slotNode[slot] = node;
+        if (nodes.size() * 2 > slotStamp.size()) growTable(); // keep load factor under 1/2
+        return node;
+    }
+
+    void heapSwap(uint32_t a, uint32_t b) {
+        std::swap(heap[a], heap[b]);
+        nodes[heap[a]].heapIndex = a;
+        nodes[heap[b]].heapIndex = b;
+    }
+
+    void siftUp(uint32_t i) {
+        while (i > 0) {
+            uint32_t parent = (i - 1) / 2;
+            if (nodes[heap[parent]].f <= nodes[heap[i]].f) break;
+            heapSwap(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(uint32_t i) {
+        uint32_t size = static_cast<uint32_t>(heap.size());
+        while (true) {
+            uint32_t l = 2 * i + 1, r = l + 1, best = i;
+            if (l < size && nodes[heap[l]].f < nodes[heap[best]].f) best = l;
+            if (r < size && nodes[heap[r]].f < nodes[heap[best]].f) best = r;
+            if (best == i) break;
+            heapSwap(i, best);
+            i = best;
+        }
+    }
+
+    uint32_t popMin() {
+        uint32_t top = heap.front();
+        heapSwap(0, static_cast<uint32_t>(heap.size() - 1));
+        heap.pop_back();
+        if (!heap.empty()) siftDown(0);
+        nodes[top].heapIndex = noNode;
+        return top;
+    }
+
+    void reset() {
+        nodes.clear();
+        heap.clear();
+        goalNode = noNode;
+        if (slotStamp.empty()) growTable();
+        if (++generation == 0) { // wrapped, stale stamps could now match
+            std::fill(slotStamp.begin(), slotStamp.end(), 0);
+            generation = 1;
+        }
+    }
+
+    void relax(uint32_t current, int ngx, int ngy, float moveCost, int goalGx, int goalGy) {
+        float tentativeG = nodes[current].g + moveCost;
+        uint32_t nb = nodeAt(ngx, ngy);
+        SearchNode& n = nodes[nb];
+        if (tentativeG >= n.g) return; // also skips closed nodes, the heuristic is consistent
+
+        n.g = tentativeG;
+        n.f = tentativeG + heuristic(ngx, ngy, goalGx, goalGy);
+        n.parent = current;
+        if (n.heapIndex == noNode) {
+            n.heapIndex = static_cast<uint32_t>(heap.size());
+            heap.push_back(nb);
+        }
+        siftUp(n.heapIndex);
+    }
+
+    void expandNeighbors(uint32_t current, int goalGx, int goalGy) {
+        int cx = nodes[current].gx;
+        int cy = nodes[current].gy;
+        unsigned walls = wallNeighborhood(cx, cy);
+        auto wallAt = [walls](int dx, int dy) { return (walls >> ((dx + 1) * 3 + dy + 1)) & 1; };
+        for (const auto& offset : neighborOffsets) {
+            int dx = offset[0];
+            int dy = offset[1];
+            int ngx = cx + dx;
+            int ngy = cy + dy;
+
+            if (wallAt(dx, dy)) continue;
+
+            // block diagonal corner cutting
+            if (dx != 0 && dy != 0) {
+                if (wallAt(dx, 0) || wallAt(0, dy)) {
+                    continue;
+                }
+            }
+
+            relax(current, ngx, ngy, heuristic(cx, cy, ngx, ngy), goalGx, goalGy); // diagonal cost ~= 1.414, straight 1
+        }
+    }
+
+    // Straight jump, a chunk word (up to 64 cells) per step. line(pos, across) returns the wall
+    // word of the chunk holding `pos` on the jump axis, `across` cells to the side of it, bit k
+    // being cell (pos & ~63) + k. A cell is forced when the cell beside it is free and the one
+    // behind that is a wall. Stops where the cell-by-cell loop would, so a wall at or before the
+    // first stop ends the jump.
+    template <typename Line>
+    static bool jumpStraight(int from, int dir, int goal, bool goalOnLine, Line&& line, int& out) {
+        const int last = wallChunkCells - 1;
+        const int cap = from + dir * jpsMaxJump;
+        uint64_t behindA = (line(from, -1) >> (from & last)) & 1;
+        uint64_t behindB = (line(from, 1) >> (from & last)) & 1;
+
+        for (int pos = from + dir;; ) {
+            int offset = pos & last;
+            int chunkStart = pos - offset;
+            uint64_t blocked = line(pos, 0);
+            uint64_t sideA = line(pos, -1);
+            uint64_t sideB = line(pos, 1);
+
+            uint64_t extra = 0;
+            if (goalOnLine && goal >= chunkStart && goal - chunkStart <= last) extra |= uint64_t(1) << (goal - chunkStart);
+            if (cap >= chunkStart && cap - chunkStart <= last) extra |= uint64_t(1) << (cap - chunkStart);
+
+            if (dir > 0) {
+                // cells pos.. to the chunk end, first hit is the lowest bit
+                uint64_t valid = ~uint64_t(0) << offset;
+                uint64_t stops = ((~sideA & (sideA << 1 | behindA << offset)) |
+                    (~sideB & (sideB << 1 | behindB << offset)) | extra) & valid;
+                blocked &= valid;
+                if (blocked | stops) {
+                    int stopBit = std::countr_zero(stops);
+                    if (std::countr_zero(blocked) <= stopBit) return false;
+                    out = chunkStart + stopBit;
+                    return true;
+                }
+                behindA = sideA >> last;
+                behindB = sideB >> last;
+                pos = chunkStart + wallChunkCells;
+            }
+            else {
+                // cells pos.. down to the chunk start, first hit is the highest bit
+                uint64_t valid = ~uint64_t(0) >> (last - offset);
+                uint64_t stops = ((~sideA & (sideA >> 1 | behindA << offset)) |
+                    (~sideB & (sideB >> 1 | behindB << offset)) | extra) & valid;
+                blocked &= valid;
+                if (blocked | stops) {
+                    int stopBit = last - std::countl_zero(stops); // -1 if none
+                    if (last - std::countl_zero(blocked) >= stopBit) return false;
+                    out = chunkStart + stopBit;
+                    return true;
+                }
+                behindA = sideA & 1;
+                behindB = sideB & 1;
+                pos = chunkStart - 1;
+            }
+        }
+    }
+
+    // Steps from (x, y) in direction (dx, dy) until a jump point: the goal, a cell with a forced
+    // neighbour, or for diagonals a cell whose straight jumps find one. Corner cutting is blocked,
+    // so straight moves are forced by a wall behind a free side cell, and diagonals have no
+    // forced neighbours of their own.
+    bool jump(int x, int y, int dx, int dy, int goalGx, int goalGy, int& outX, int& outY) const {
+        if (dy == 0) {
+            outY = y;
+            return jumpStraight(x, dx, goalGx, goalGy == y, [y](int pos, int across) {
+                int gy = y + across;
+                return wallChunk(pos >> wallChunkShift, gy >> wallChunkShift).rows[gy & (wallChunkCells - 1)];
+            }, outX);
+        }
+        if (dx == 0) {
+            outX = x;
+            return jumpStraight(y, dy, goalGy, goalGx == x, [x](int pos, int across) {
+                int gx = x + across;
+                return wallChunk(gx >> wallChunkShift, pos >> wallChunkShift).cols[gx & (wallChunkCells - 1)];
+            }, outY);
+        }
+
+        for (int steps = 1;; ++steps) {
+            if (dx != 0 && dy != 0 && (isWall(x + dx, y) || isWall(x, y + dy))) return false;
+            x += dx;
+            y += dy;
+            if (isWall(x, y)) return false;
+
+            bool jumpPoint = (x == goalGx && y == goalGy) || steps >= jpsMaxJump;
+            if (!jumpPoint) {
+                int ignoreX, ignoreY;
+                if (dx != 0 && dy != 0) {
+                    jumpPoint = jump(x, y, dx, 0, goalGx, goalGy, ignoreX, ignoreY) ||
+                        jump(x, y, 0, dy, goalGx, goalGy, ignoreX, ignoreY);
+                }
+                else if (dx != 0) {
+                    jumpPoint = (!isWall(x, y - 1) && isWall(x - dx, y - 1)) ||
+                        (!isWall(x, y + 1) && isWall(x - dx, y + 1));
+                }
+                else {
+                    jumpPoint = (!isWall(x - 1, y) && isWall(x - 1, y - dy)) ||
+                        (!isWall(x + 1, y) && isWall(x + 1, y - dy));
+                }
+            }
+            if (jumpPoint) {
+                outX = x;
+                outY = y;
+                return true;
+            }
+        }
+    }
+
+    void expandJumpPoints(uint32_t current, int goalGx, int goalGy) {
+        int cx = nodes[current].gx;
+        int cy = nodes[current].gy;
+        uint32_t parent = nodes[current].parent;
+        if (parent == noNode) {
+            for (const auto& offset : neighborOffsets) {
+                int jx, jy;
+                if (jump(cx, cy, offset[0], offset[1], goalGx, goalGy, jx, jy)) {
+                    relax(current, jx, jy, heuristic(cx, cy, jx, jy), goalGx, goalGy);
+                }
+            }
+            return;
+        }
+
+        // prune to the directions a path arriving from the parent can't reach more cheaply
+        int dx = (cx > nodes[parent].gx) - (cx < nodes[parent].gx);
+        int dy = (cy > nodes[parent].gy) - (cy < nodes[parent].gy);
+        int dirs[5][2];
+        int count = 0;
+        if (dx != 0 && dy != 0) {
+            dirs[count][0] = 0;  dirs[count++][1] = dy;
+            dirs[count][0] = dx; dirs[count++][1] = 0;
+            dirs[count][0] = dx; dirs[count++][1] = dy;
+        }
+        else if (dx != 0) {
+            for (int side = -1; side <= 1; ++side) { dirs[count][0] = dx; dirs[count++][1] = side; }
+            dirs[count][0] = 0; dirs[count++][1] = -1;
+            dirs[count][0] = 0; dirs[count++][1] = 1;
+        }
+        else {
+            for (int side = -1; side <= 1; ++side) { dirs[count][0] = side; dirs[count++][1] = dy; }
+            dirs[count][0] = -1; dirs[count++][1] = 0;
+            dirs[count][0] = 1;  dirs[count++][1] = 0;
+        }
+
+        for (int k = 0; k < count; ++k) {
+            int jx, jy;
+            if (jump(cx, cy, dirs[k][0], dirs[k][1], goalGx, goalGy, jx, jy)) {
+                // jumps run in a straight or diagonal line, so this is also the summed step cost
+                relax(current, jx, jy, heuristic(cx, cy, jx, jy), goalGx, goalGy);
+            }
+        }
+    }
+
+public:
+    // Grid search from start to goal cell. On success the path can be read with tracePath.
+    bool search(int startGx, int startGy, int goalGx, int goalGy, PathSearchMode mode, uint32_t nodeLimit = maxSearchNodes) {
+        reset();
+
+        uint32_t start = nodeAt(startGx, startGy);
+        nodes[start].g = 0.f;
+        nodes[start].f = heuristic(startGx, startGy, goalGx, goalGy);
+        nodes[start].heapIndex = 0;
+        heap.push_back(start);
+
+        while (!heap.empty()) {
+            uint32_t current = popMin();
+            if (nodes[current].gx == goalGx && nodes[current].gy == goalGy) {
+                goalNode = current;
+                return true;
+            }
+            if (nodes.size() >= nodeLimit) return false;
+
+            if (mode == PathSearchMode::JumpPoint) {
+                expandJumpPoints(current, goalGx, goalGy);
+            }
+            else {
+                expandNeighbors(current, goalGx, goalGy);
+            }
+        }
+        // failed to find path
+        return false;
+    }
+
+    // calls fn(gx, gy) for every cell of the last found path, goal first. Jump point paths are
+    // filled in cell by cell, so both modes produce the same kind of path.
+    template <typename Fn>
+    void tracePath(Fn&& fn) const {
+        for (uint32_t n = goalNode; n != noNode; n = nodes[n].parent) {
+            int x = nodes[n].gx;
+            int y = nodes[n].gy;
+            fn(x, y);
+
+            uint32_t parent = nodes[n].parent;
+            if (parent == noNode) break;
+            int px = nodes[parent].gx;
+            int py = nodes[parent].gy;
+            int dx = (px > x) - (px < x);
+            int dy = (py > y) - (py < y);
+            for (x += dx, y += dy; x != px || y != py; x += dx, y += dy) {
+                fn(x, y);
+            }
+        }
+    }
+};
+
+/* hierarchical pathfinding ---------------------------------------------------------------------------- */
+const int hpaChunkSize = 16;              // cells per chunk side
+const int hpaMinCells = 2 * hpaChunkSize; // shorter orders go straight to the grid search
+const size_t hpaMaxChunks = 4096;         // cache bound, the graph is dropped and rebuilt past this
+const uint32_t hpaMaxExpansions = 50000;
+
+// HPA* abstract graph over hpaChunkSize x hpaChunkSize chunks of the map. Each run of open cells
+// along a chunk border becomes one or two entrances (a node on both sides of the border), and
+// the entrances of a chunk are linked by their in-chunk path costs. Chunks are analysed the
+// first time a search touches them and cached from then on, so a cross-map order only expands
+// a few entrances per chunk. The abstract path is refined into cells by short grid searches.
+class HpaGraph {
+private:
+    static constexpr uint32_t noNode = UINT32_MAX;
+    static constexpr uint32_t goalId = UINT32_MAX - 1; // virtual node for the query goal
+    static constexpr int chunkCells = hpaChunkSize * hpaChunkSize;
+
+    struct AbstractEdge {
+        uint32_t to;
+        float cost;
+    };
+    struct AbstractNode {
+        int gx, gy;
+        std::vector<AbstractEdge> edges;
+    };
+
+    std::vector<AbstractNode> nodes;
+    std::unordered_map<long long, uint32_t> nodeAtCell;
+    std::unordered_map<long long, std::vector<uint32_t>> chunkMembers; // entrance nodes per chunk
+    std::unordered_set<long long> builtChunks;
+    std::unordered_set<long long> eastBordersDone;  // keyed by the chunk west of the border
+    std::unordered_set<long long> southBordersDone; // keyed by the chunk north of the border
+    uint32_t builtEpoch = 0; // wallEpoch the cached chunks were analysed under
+
+    // per-query search state, indexed by node id and stamped so it never needs clearing
+    std::vector<float> searchG;
+    std::vector<uint32_t> searchParent;
+    std::vector<uint32_t> searchStamp;
+    uint32_t searchGeneration = 0;
+    std::vector<std::pair<uint32_t, float>> startEdges;
+    std::vector<std::pair<uint32_t, float>> goalEdges;
+
+    // heaps and scratch kept between queries, cleared instead of reallocated
+    struct ChunkItem {
+        float d;
+        int local;
+        bool operator<(ChunkItem const& o) const { return d > o.d; } // min-heap
+    };
+    struct AbstractItem {
+        float f;
+        float g;
+        uint32_t node;
+        bool operator<(AbstractItem const& o) const { return f > o.f; } // min-heap
+    };
+    std::vector<ChunkItem> chunkOpen;
+    std::vector<AbstractItem> abstractOpen;
+    std::vector<uint32_t> linkMembers;
+
+    uint32_t nodeAt(int gx, int gy) {
+        auto [it, inserted] = nodeAtCell.try_emplace(hashKey(gx, gy), static_cast<uint32_t>(nodes.size()));
+        if (inserted) {
+            nodes.push_back({ gx, gy, {} });
+            chunkMembers[hashKey(floorDiv(gx, hpaChunkSize), floorDiv(gy, hpaChunkSize))].push_back(it->second);
+        }
+        return it->second;
+    }
+
+    void addTransition(int ax, int ay, int bx, int by) {
+        uint32_t a = nodeAt(ax, ay);
+        uint32_t b = nodeAt(bx, by);
+        nodes[a].edges.push_back({ b, 1.f });
+        nodes[b].edges.push_back({ a, 1.f });
+    }
+
+    // Border between cells (x0 + i * stepX, y0 + i * stepY) and the cells one step across it.
+    // Runs shorter than 6 get one entrance in the middle, longer ones one at each end.
+    void buildBorder(int x0, int y0, int stepX, int stepY, int acrossX, int acrossY) {
+        int runStart = -1;
+        for (int i = 0; i <= hpaChunkSize; ++i) {
+            bool open = i < hpaChunkSize &&
+                !isWall(x0 + i * stepX, y0 + i * stepY) &&
+                !isWall(x0 + i * stepX + acrossX, y0 + i * stepY + acrossY);
+            if (open && runStart < 0) runStart = i;
+            if (!open && runStart >= 0) {
+                int runEnd = i - 1;
+                auto place = [&](int k) {
+                    int ax = x0 + k * stepX, ay = y0 + k * stepY;
+                    addTransition(ax, ay, ax + acrossX, ay + acrossY);
+                };
+                if (runEnd - runStart + 1 < 6) {
+                    place((runStart + runEnd) / 2);
+                }
+                else {
+                    place(runStart);
+                    place(runEnd);
+                }
+                runStart = -1;
+            }
+        }
+    }
+
+    void ensureEastBorder(int cx, int cy) {
+        if (!eastBordersDone.insert(hashKey(cx, cy)).second) return;
+        buildBorder(cx * hpaChunkSize + hpaChunkSize - 1, cy * hpaChunkSize, 0, 1, 1, 0);
+    }
+
+    void ensureSouthBorder(int cx, int cy) {
+        if (!southBordersDone.insert(hashKey(cx, cy)).second) return;
+        buildBorder(cx * hpaChunkSize, cy * hpaChunkSize + hpaChunkSize - 1, 1, 0, 0, 1);
+    }
+
+    // Dijkstra from (sx, sy) that never leaves chunk (cx, cy). dist is indexed by local cell.
+    void chunkDijkstra(int cx, int cy, const uint8_t* wall, int sx, int sy, float* dist) {
+        int ox = cx * hpaChunkSize, oy = cy * hpaChunkSize;
+        std::fill(dist, dist + chunkCells, std::numeric_limits<float>::infinity());
+
+        std::vector<ChunkItem>& open = chunkOpen;
+        open.clear();
+        int startLocal = (sy - oy) * hpaChunkSize + (sx - ox);
+        dist[startLocal] = 0.f;
+        open.push_back({ 0.f, startLocal });
+
+        auto blocked = [&](int lx, int ly) {
+            return lx < 0 || ly < 0 || lx >= hpaChunkSize || ly >= hpaChunkSize || wall[ly * hpaChunkSize + lx];
+        };
+
+        while (!open.empty()) {
+            std::pop_heap(open.begin(), open.end());
+            ChunkItem top = open.back();
+            open.pop_back();
+            if (top.d > dist[top.local]) continue;
+            int lx = top.local % hpaChunkSize;
+            int ly = top.local / hpaChunkSize;
+
+            for (const auto& offset : neighborOffsets) {
+                int dx = offset[0], dy = offset[1];
+                if (blocked(lx + dx, ly + dy)) continue;
+                if (dx != 0 && dy != 0 && (blocked(lx + dx, ly) || blocked(lx, ly + dy))) continue;
+
+                float nd = top.d + heuristic(0, 0, dx, dy);
+                int nl = (ly + dy) * hpaChunkSize + (lx + dx);
+                if (nd < dist[nl]) {
+                    dist[nl] = nd;
+                    open.push_back({ nd, nl });
+                    std::push_heap(open.begin(), open.end());
+                }
+            }
+        }
+    }
+
+    static void chunkWalls(int cx, int cy, uint8_t* wall) {
+        for (int ly = 0; ly < hpaChunkSize; ++ly) {
+            uint64_t bits = wallRow(cx * hpaChunkSize, cy * hpaChunkSize + ly);
+            for (int lx = 0; lx < hpaChunkSize; ++lx) {
+                wall[ly * hpaChunkSize + lx] = (bits >> lx) & 1;
+            }
+        }
+    }
+
+    // costs from (gx, gy) to every entrance of its chunk, reachable ones only
+    void connectToChunk(int gx, int gy, std::vector<std::pair<uint32_t, float>>& out) {
+        int cx = floorDiv(gx, hpaChunkSize), cy = floorDiv(gy, hpaChunkSize);
+        ensureChunk(cx, cy);
+
+        uint8_t wall[chunkCells];
+        float dist[chunkCells];
+        chunkWalls(cx, cy, wall);
+        chunkDijkstra(cx, cy, wall, gx, gy, dist);
+
+        out.clear();
+        for (uint32_t n : chunkMembers[hashKey(cx, cy)]) {
+            float d = dist[(nodes[n].gy - cy * hpaChunkSize) * hpaChunkSize + (nodes[n].gx - cx * hpaChunkSize)];
+            if (d != std::numeric_limits<float>::infinity()) out.emplace_back(n, d);
+        }
+    }
+
+    void ensureChunk(int cx, int cy) {
+        if (builtChunks.count(hashKey(cx, cy))) return;
+        builtChunks.insert(hashKey(cx, cy));
+
+        ensureEastBorder(cx, cy);
+        ensureEastBorder(cx - 1, cy);
+        ensureSouthBorder(cx, cy);
+        ensureSouthBorder(cx, cy - 1);
+
+        uint8_t wall[chunkCells];
+        float dist[chunkCells];
+        chunkWalls(cx, cy, wall);
+
+        // copy, nodes can't be added while linking but the map may rehash
+        std::vector<uint32_t>& members = linkMembers;
+        members = chunkMembers[hashKey(cx, cy)];
+        for (uint32_t a : members) {
+            chunkDijkstra(cx, cy, wall, nodes[a].gx, nodes[a].gy, dist);
+            for (uint32_t b : members) {
+                if (a == b) continue;
+                float d = dist[(nodes[b].gy - cy * hpaChunkSize) * hpaChunkSize + (nodes[b].gx - cx * hpaChunkSize)];
+                if (d != std::numeric_limits<float>::infinity()) nodes[a].edges.push_back({ b, d });
+            }
+        }
+    }
+
+public:
+    void clear() {
+        nodes.clear();
+        nodeAtCell.clear();
+        chunkMembers.clear();
+        builtChunks.clear();
+        eastBordersDone.clear();
+        southBordersDone.clear();
+    }
+
+    // Abstract path from start to goal cell as a list of waypoint cells, start and goal included.
+    // Consecutive waypoints are in the same or adjacent chunks. False if the abstract search fails.
+    bool findAbstractPath(int startGx, int startGy, int goalGx, int goalGy, std::vector<std::pair<int, int>>& waypoints) {
+        // any wall edit may have moved entrances, the graph is rebuilt lazily like after a flush
+        uint32_t epoch = wallEpoch.load(std::memory_order_acquire);
+        if (builtChunks.size() >= hpaMaxChunks || builtEpoch != epoch) {
+            clear();
+            builtEpoch = epoch;
+        }
+
+        connectToChunk(startGx, startGy, startEdges);
+        connectToChunk(goalGx, goalGy, goalEdges);
+        if (startEdges.empty() || goalEdges.empty()) return false;
+
+        if (++searchGeneration == 0) {
+            std::fill(searchStamp.begin(), searchStamp.end(), 0);
+            searchGeneration = 1;
+        }
+
+        std::vector<AbstractItem>& open = abstractOpen;
+        open.clear();
+        auto push = [&](AbstractItem item) {
+            open.push_back(item);
+            std::push_heap(open.begin(), open.end());
+        };
+
+        auto touch = [&](uint32_t n) {
+            if (n >= searchStamp.size()) {
+                searchStamp.resize(nodes.size(), 0);
+                searchG.resize(nodes.size());
+                searchParent.resize(nodes.size());
+            }
+            if (searchStamp[n] != searchGeneration) {
+                searchStamp[n] = searchGeneration;
+                searchG[n] = std::numeric_limits<float>::infinity();
+                searchParent[n] = noNode;
+            }
+        };
+        auto h = [&](uint32_t n) { return heuristic(nodes[n].gx, nodes[n].gy, goalGx, goalGy); };
+
+        for (auto [n, cost] : startEdges) {
+            touch(n);
+            if (cost < searchG[n]) {
+                searchG[n] = cost;
+                push({ cost + h(n), cost, n });
+            }
+        }
+
+        float bestGoal = std::numeric_limits<float>::infinity();
+        uint32_t bestGoalParent = noNode;
+        uint32_t expansions = 0;
+
+        while (!open.empty() && expansions++ < hpaMaxExpansions) {
+            std::pop_heap(open.begin(), open.end());
+            AbstractItem top = open.back();
+            open.pop_back();
+            if (top.node == goalId) break;
+            if (top.g > searchG[top.node]) continue; // stale entry
+
+            for (auto [gn, cost] : goalEdges) {
+                if (gn == top.node && top.g + cost < bestGoal) {
+                    bestGoal = top.g + cost;
+                    bestGoalParent = top.node;
+                    push({ bestGoal, bestGoal, goalId });
+                }
+            }
+
+            // first expansion in a chunk pulls in its intra-chunk edges
+            ensureChunk(floorDiv(nodes[top.node].gx, hpaChunkSize), floorDiv(nodes[top.node].gy, hpaChunkSize));
+            for (size_t e = 0; e < nodes[top.node].edges.size(); ++e) {
+                AbstractEdge edge = nodes[top.node].edges[e];
+                float g = top.g + edge.cost;
+                touch(edge.to);
+                if (g < searchG[edge.to]) {
+                    searchG[edge.to] = g;
+                    searchParent[edge.to] = top.node;
+                    push({ g + h(edge.to), g, edge.to });
+                }
+            }
+        }
+        if (bestGoalParent == noNode) return false;
+
+        waypoints.clear();
+        waypoints.emplace_back(goalGx, goalGy);
+        for (uint32_t n = bestGoalParent; n != noNode; n = searchParent[n]) {
+            waypoints.emplace_back(nodes[n].gx, nodes[n].gy);
+        }
+        waypoints.emplace_back(startGx, startGy);
+        std::reverse(waypoints.begin(), waypoints.end());
+        return true;
+    }
+};
+/* --------------------------------------------------------------------------------------------------- */
+
+/* path cache ---------------------------------------------------------------------------------------- */
+const size_t pathCacheCapacity = 256;
+
+// Bounded LRU of found paths keyed on (start cell, goal cell), shared by the path workers.
+// A request whose start cell lies on a cached path to the same goal gets the rest of that path.
+// invalidateCell must be called for any cell whose wall state changes, after wallEpoch is bumped.
+class PathCache {
+private:
+    struct Entry {
+        long long startKey;
+        long long goalKey;
+        std::vector<std::pair<int, int>> cells; // start to goal
+        int minGx, minGy, maxGx, maxGy;         // bounds of cells
+    };
+    using EntryList = std::list<Entry>;
+
+    // (startKey, goalKey), hashed by mixing the two cell keys
+    using PairKey = std::pair<long long, long long>;
+    struct PairKeyHash {
+        size_t operator()(const PairKey& key) const {
+            return std::hash<long long>()(key.first ^ (key.second * 0x9E3779B97F4A7C15ll));
+        }
+    };
+
+    EntryList lru; // most recently used first
+    std::unordered_map<PairKey, EntryList::iterator, PairKeyHash> byStart;
+    std::unordered_multimap<long long, EntryList::iterator> byGoal;
+    size_t capacity;
+    PathCacheStats counters;
+    mutable boost::mutex mutex;
+
+    void erase(EntryList::iterator it) {
+        auto range = byGoal.equal_range(it->goalKey);
+        for (auto g = range.first; g != range.second; ++g) {
+            if (g->second == it) {
+                byGoal.erase(g);
+                break;
+            }
+        }
+        byStart.erase({ it->startKey, it->goalKey });
+        lru.erase(it);
+    }
+
+    static void emit(const std::vector<std::pair<int, int>>& cells, size_t from, std::deque<sf::Vector2f>& out) {
+        out.clear();
+        for (size_t i = from; i < cells.size(); ++i) {
+            out.push_back(gridToWorldCoord(cells[i].first, cells[i].second));
+        }
+    }
+
+public:
+    explicit PathCache(size_t capacity) : capacity(capacity) {}
+
+    bool lookup(int startGx, int startGy, int goalGx, int goalGy, std::deque<sf::Vector2f>& out) {
+        long long startKey = hashKey(startGx, startGy);
+        long long goalKey = hashKey(goalGx, goalGy);
+        boost::lock_guard<boost::mutex> lock(mutex);
+
+        auto it = byStart.find({ startKey, goalKey });
+        if (it != byStart.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            emit(it->second->cells, 0, out);
+            ++counters.hits;
+            return true;
+        }
+
+        // sub-path reuse: any cached path to the same goal that passes through the start cell
+        auto range = byGoal.equal_range(goalKey);
+        for (auto g = range.first; g != range.second; ++g) {
+            const Entry& e = *g->second;
+            if (startGx < e.minGx || startGx > e.maxGx || startGy < e.minGy || startGy > e.maxGy) continue;
+            for (size_t i = 0; i < e.cells.size(); ++i) {
+                if (e.cells[i].first == startGx && e.cells[i].second == startGy) {
+                    lru.splice(lru.begin(), lru, g->second);
+                    emit(e.cells, i, out);
+                    ++counters.subPathHits;
+                    return true;
+                }
+            }
+        }
+
+        ++counters.misses;
+        return false;
+    }
+
+    // epoch is the wallEpoch the path was searched under. Checked under the lock, so a path either
+    // goes in before the invalidateCell of a later edit, which then drops it, or not at all.
+    void insert(const std::deque<sf::Vector2f>& path, uint32_t epoch) {
+        if (path.empty()) return;
+
+        Entry e;
+        e.cells.reserve(path.size());
+        for (const auto& p : path) {
+            e.cells.emplace_back(static_cast<int>(std::floor(p.x / gridSize)), static_cast<int>(std::floor(p.y / gridSize)));
+        }
+        e.startKey = hashKey(e.cells.front().first, e.cells.front().second);
+        e.goalKey = hashKey(e.cells.back().first, e.cells.back().second);
+        e.minGx = e.maxGx = e.cells.front().first;
+        e.minGy = e.maxGy = e.cells.front().second;
+        for (auto [gx, gy] : e.cells) {
+            e.minGx = std::min(e.minGx, gx);
+            e.maxGx = std::max(e.maxGx, gx);
+            e.minGy = std::min(e.minGy, gy);
+            e.maxGy = std::max(e.maxGy, gy);
+        }
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        if (wallEpoch.load(std::memory_order_acquire) != epoch) return; // the walls changed mid-search
+        auto existing = byStart.find({ e.startKey, e.goalKey });
+        if (existing != byStart.end()) erase(existing->second);
+
+        lru.push_front(std::move(e));
+        byStart[{ lru.front().startKey, lru.front().goalKey }] = lru.begin();
+        byGoal.emplace(lru.front().goalKey, lru.begin());
+
+        while (lru.size() > capacity) {
+            erase(std::prev(lru.end()));
+            ++counters.evictions;
+        }
+    }
+
+    // Drops every path that could be affected by (gx, gy) changing: anything passing within a cell
+    // of it (a new wall blocks it or a diagonal past it) or whose bounds cover it (a removed wall
+    // may open a shorter route).
+    void invalidateCell(int gx, int gy) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        for (auto it = lru.begin(); it != lru.end();) {
+            auto next = std::next(it);
+            if (gx >= it->minGx - 1 && gx <= it->maxGx + 1 && gy >= it->minGy - 1 && gy <= it->maxGy + 1) {
+                erase(it);
+                ++counters.invalidations;
+            }
+            it = next;
+        }
+    }
+
+    void clear() {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        lru.clear();
+        byStart.clear();
+        byGoal.clear();
+    }
+
+    PathCacheStats stats() const {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        return counters;
+    }
+};
+
+PathCache pathCache(pathCacheCapacity);
+
+PathCacheStats pathCacheStats() {
+    return pathCache.stats();
+}
+
+void clearPathCache() {
+    pathCache.clear();
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* wall edits ---------------------------------------------------------------------------------------- */
+struct WallEdit {
+    uint8_t x, y; // cell within its chunk
+    bool wall;
+};
+
+// edits per chunk, keyed by wallChunkKey. Read whenever some thread fills a chunk.
+static boost::mutex wallEditsMutex;
+static std::unordered_map<long long, std::vector<WallEdit>> wallEdits;
+
+// the most recent edits in order, for wallCellsChangedSince
+struct WallChange {
+    uint32_t epoch; // wallEpoch right after the edit
+    int gx, gy;
+};
+const size_t wallChangeLogSize = 1024;
+static std::deque<WallChange> wallChanges;
+static uint32_t wallChangesFrom = 0; // the log holds every edit after this epoch
+
+void applyWallEdits(int cx, int cy, WallChunk& chunk) {
+    boost::lock_guard<boost::mutex> lock(wallEditsMutex);
+    auto it = wallEdits.find(wallChunkKey(cx, cy));
+    if (it == wallEdits.end()) return;
+    for (const WallEdit& edit : it->second) {
+        uint64_t rowBit = uint64_t(1) << edit.x;
+        uint64_t colBit = uint64_t(1) << edit.y;
+        if (edit.wall) {
+            chunk.rows[edit.y] |= rowBit;
+            chunk.cols[edit.x] |= colBit;
+        }
+        else {
+            chunk.rows[edit.y] &= ~rowBit;
+            chunk.cols[edit.x] &= ~colBit;
+        }
+    }
+}
+
+bool wallCellsChangedSince(uint32_t since, std::vector<std::pair<int, int>>& cells) {
+    boost::lock_guard<boost::mutex> lock(wallEditsMutex);
+    cells.clear();
+    if (since < wallChangesFrom) return false;
+    for (auto it = wallChanges.rbegin(); it != wallChanges.rend() && it->epoch > since; ++it) {
+        cells.emplace_back(it->gx, it->gy);
+    }
+    return true;
+}
+
+void setWallCell(int gx, int gy, bool wall) {
+    {
+        boost::lock_guard<boost::mutex> lock(wallEditsMutex);
+        std::vector<WallEdit>& edits = wallEdits[wallChunkKey(gx >> wallChunkShift, gy >> wallChunkShift)];
+        WallEdit edit{ static_cast<uint8_t>(gx & (wallChunkCells - 1)), static_cast<uint8_t>(gy & (wallChunkCells - 1)), wall };
+        auto same = std::find_if(edits.begin(), edits.end(), [&](const WallEdit& e) { return e.x == edit.x && e.y == edit.y; });
+        if (same != edits.end()) *same = edit;
+        else edits.push_back(edit);
+
+        uint32_t epoch = wallEpoch.fetch_add(1, std::memory_order_release) + 1;
+        wallChanges.push_back({ epoch, gx, gy });
+        if (wallChanges.size() > wallChangeLogSize) {
+            wallChangesFrom = wallChanges.front().epoch;
+            wallChanges.pop_front();
+        }
+    }
+    pathCache.invalidateCell(gx, gy);
+}
+
+void clearWallEdits() {
+    {
+        boost::lock_guard<boost::mutex> lock(wallEditsMutex);
+        wallEdits.clear();
+        wallChanges.clear();
+        wallChangesFrom = wallEpoch.fetch_add(1, std::memory_order_release) + 1;
+    }
+    pathCache.clear();
+}
+
+// every edit as world cells, sorted so the same map always saves the same bytes
+static void collectWallEdits(std::vector<SaveWallEdit>& out) {
+    out.clear();
+    {
+        boost::lock_guard<boost::mutex> lock(wallEditsMutex);
+        for (const auto& [key, edits] : wallEdits) {
+            int cx = static_cast<int>(key >> 32);
+            int cy = static_cast<int32_t>(static_cast<uint32_t>(key));
+            for (const WallEdit& edit : edits) {
+                out.push_back({ cx * wallChunkCells + edit.x, cy * wallChunkCells + edit.y, edit.wall ? 1u : 0u });
+            }
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const SaveWallEdit& a, const SaveWallEdit& b) {
+        return a.gy != b.gy ? a.gy < b.gy : a.gx < b.gx;
+    });
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+// cached = false neither reads nor fills the path cache, whose sub-path hits depend on what was
+// searched before
+std::deque<sf::Vector2f> findPathAstar(const sf::Vector2f& startWorld, const sf::Vector2f& goalWorld, bool cached = true) {
+    PROFILE_ZONE("findPathAstar");
+    const uint32_t epoch = wallEpoch.load(std::memory_order_acquire); // before the cache, so never newer than the walls read
+    syncWallCache();
+    // Convert to grid coords
+    int startGx = static_cast<int>(std::floor(startWorld.x / gridSize));
+    int startGy = static_cast<int>(std::floor(startWorld.y / gridSize));
+    int goalGx = static_cast<int>(std::floor(goalWorld.x / gridSize));
+    int goalGy = static_cast<int>(std::floor(goalWorld.y / gridSize));
+
+    if (!resolveGoalCell(goalGx, goalGy)) {
+        return {};
+    }
+
+    std::deque<sf::Vector2f> path;
+    if (cached && pathCache.lookup(startGx, startGy, goalGx, goalGy, path)) {
+        return path;
+    }
+
+    thread_local AstarContext context;
+    PathSearchMode mode = pathSearchMode.load(std::memory_order_relaxed);
+
+    // Long orders: search the chunk graph, then refine each leg with a short grid search
+    if (std::max(std::abs(goalGx - startGx), std::abs(goalGy - startGy)) >= hpaMinCells) {
+        thread_local HpaGraph hpa;
+        thread_local std::vector<std::pair<int, int>> waypoints;
+        thread_local std::vector<std::pair<int, int>> leg;
+
+        if (hpa.findAbstractPath(startGx, startGy, goalGx, goalGy, waypoints)) {
+            path.push_back(gridToWorldCoord(startGx, startGy));
+            bool refined = true;
+            for (size_t i = 0; i + 1 < waypoints.size(); ++i) {
+                auto [ax, ay] = waypoints[i];
+                auto [bx, by] = waypoints[i + 1];
+                if (ax == bx && ay == by) continue;
+
+                refined = context.search(ax, ay, bx, by, mode);
+                if (!refined) break;
+
+                leg.clear();
+                context.tracePath([&](int gx, int gy) { leg.emplace_back(gx, gy); });
+                // leg runs goal first and ends with the waypoint already on the path
+                for (size_t k = leg.size() - 1; k-- > 0;) {
+                    path.push_back(gridToWorldCoord(leg[k].first, leg[k].second));
+                }
+            }
+            if (refined) {
+                if (cached) pathCache.insert(path, epoch);
+                return path;
+            }
+            path.clear();
+        }
+    }
+
+    if (context.search(startGx, startGy, goalGx, goalGy, mode)) {
+        context.tracePath([&](int gx, int gy) { path.push_front(gridToWorldCoord(gx, gy)); });
+        if (cached) pathCache.insert(path, epoch);
+    }
+    return path;
+}
+
+// Plain grid search on the calling thread, cells from start to goal. For short hops that aren't
+// worth a trip through the path workers or the cache; gives up after nodeLimit nodes.
+bool findGridPath(int startGx, int startGy, int goalGx, int goalGy, uint32_t nodeLimit, std::vector<std::pair<int, int>>& cells) {
+    thread_local AstarContext context;
+    if (!context.search(startGx, startGy, goalGx, goalGy, pathSearchMode.load(std::memory_order_relaxed), nodeLimit)) return false;
+    cells.clear();
+    context.tracePath([&](int gx, int gy) { cells.emplace_back(gx, gy); });
+    std::reverse(cells.begin(), cells.end());
+    return true;
+}
+
+/* incremental path repair --------------------------------------------------------------------------- */
+const uint32_t repairMaxNodes = 1u << 16;     // a planner growing past this gives up
+const uint32_t repairMaxExpansions = 1u << 15; // per repair
+const uint32_t repairTickBudget = 1u << 14;    // expansions per tick over all repairs, the rest wait
+const int repairGoalShift = 3;                 // re-clicks this many cells from the goal keep the path
+
+// one step between neighbouring cells under the search rules: no walls, no corner cutting
+static bool stepOpen(int ax, int ay, int bx, int by) {
+    int dx = bx - ax, dy = by - ay;
+    if (std::abs(dx) > 1 || std::abs(dy) > 1 || isWall(bx, by)) return false;
+    return dx == 0 || dy == 0 || (!isWall(bx, ay) && !isWall(ax, by));
+}
+
+// D* Lite (Koenig & Likhachev) for one waffle. It searches backwards from the goal, so g is the
+// cost from a cell to the goal and stays valid while the waffle moves: re-planning from a new
+// start only expands cells whose cost the move changed, which after a shove is usually none, and
+// a wall edit only re-expands the cells downstream of it. The path is read off by walking downhill
+// from the start. Same grid rules as AstarContext; nodes live in an open-addressing table and the
+// open list is a binary heap with back-pointers, so keys can be changed and entries removed.
+class DStarLite {
+private:
+    static constexpr uint32_t noNode = UINT32_MAX;
+    static constexpr float infinity = std::numeric_limits<float>::infinity();
+    static constexpr float stepCosts[8] = { 1.41421356f, 1.f, 1.41421356f, 1.f, 1.f, 1.41421356f, 1.f, 1.41421356f }; // by neighborOffsets
+
+    struct Key {
+        float k1, k2;
+        bool operator<(const Key& o) const { return k1 < o.k1 || (k1 == o.k1 && k2 < o.k2); }
+    };
+
+    struct Node {
+        int gx, gy;
+        float g, rhs;
+        Key key;
+        uint32_t heapIndex; // noNode when not queued
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> heap;
+    std::vector<uint32_t> slots; // node index + 1, 0 for empty
+    int goalGx = 0, goalGy = 0;
+    int startGx = 0, startGy = 0;
+    float km = 0.f; // heuristic drift since the first plan, keeps old keys comparable
+    std::vector<std::pair<int, int>> pendingEdits; // wall edits not folded in yet
+
+    static uint32_t hashCell(int gx, int gy) {
+        uint32_t h = static_cast<uint32_t>(gx) * 0x9E3779B1u ^ static_cast<uint32_t>(gy) * 0x85EBCA77u;
+        return h ^ (h >> 15);
+    }
+
+    uint32_t find(int gx, int gy) const {
+        uint32_t mask = static_cast<uint32_t>(slots.size() - 1);
+        for (uint32_t slot = hashCell(gx, gy) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+            const Node& n = nodes[slots[slot] - 1];
+            if (n.gx == gx && n.gy == gy) return slots[slot] - 1;
+        }
+        return noNode;
+    }
+
+    void insertSlot(uint32_t node) {
+        uint32_t mask = static_cast<uint32_t>(slots.size() - 1);
+        uint32_t slot = hashCell(nodes[node].gx, nodes[node].gy) & mask;
+        while (slots[slot] != 0) slot = (slot + 1) & mask;
+        slots[slot] = node + 1;
+    }
+
+    // creates the node (g = rhs = infinity) if the planner hasn't seen the cell
+    uint32_t nodeAt(int gx, int gy) {
+        uint32_t found = find(gx, gy);
+        if (found != noNode) return found;
+
+        uint32_t node = static_cast<uint32_t>(nodes.size());
+        nodes.push_back({ gx, gy, infinity, infinity, { 0.f, 0.f }, noNode });
+        if (nodes.size() * 2 > slots.size()) {
+            slots.assign(slots.size() * 2, 0);
+            for (uint32_t n = 0; n < nodes.size(); ++n) insertSlot(n);
+        }
+        else {
+            insertSlot(node);
+        }
+        return node;
+    }
+
+    Key keyOf(uint32_t node) const {
+        const Node& n = nodes[node];
+        float m = std::min(n.g, n.rhs);
+        return { m + heuristic(startGx, startGy, n.gx, n.gy) + km, m };
+    }
+
+    void heapSwap(uint32_t a, uint32_t b) {
+        std::swap(heap[a], heap[b]);
+        nodes[heap[a]].heapIndex = a;
+        nodes[heap[b]].heapIndex = b;
+    }
+
+    void siftUp(uint32_t i) {
+        while (i > 0) {
+            uint32_t parent = (i - 1) / 2;
+            if (!(nodes[heap[i]].key < nodes[heap[parent]].key)) break;
+            heapSwap(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(uint32_t i) {
+        uint32_t size = static_cast<uint32_t>(heap.size());
+        while (true) {
+            uint32_t l = 2 * i + 1, r = l + 1, best = i;
+            if (l < size && nodes[heap[l]].key < nodes[heap[best]].key) best = l;
+            if (r < size && nodes[heap[r]].key < nodes[heap[best]].key) best = r;
+            if (best == i) break;
+            heapSwap(i, best);
+            i = best;
+        }
+    }
+
+    void enqueue(uint32_t node) {
+        nodes[node].key = keyOf(node);
+        if (nodes[node].heapIndex == noNode) {
+            nodes[node].heapIndex = static_cast<uint32_t>(heap.size());
+            heap.push_back(node);
+        }
+        else {
+            siftDown(nodes[node].heapIndex);
+        }
+        siftUp(nodes[node].heapIndex);
+    }
+
+    void dequeue(uint32_t node) {
+        uint32_t i = nodes[node].heapIndex;
+        if (i == noNode) return;
+        heapSwap(i, static_cast<uint32_t>(heap.size() - 1));
+        heap.pop_back();
+        nodes[node].heapIndex = noNode;
+        if (i < heap.size()) {
+            siftDown(i);
+            siftUp(i);
+        }
+    }
+
+    // on the open list exactly while inconsistent
+    void settle(uint32_t node) {
+        if (nodes[node].g != nodes[node].rhs) enqueue(node);
+        else dequeue(node);
+    }
+
+    // rhs from every neighbour the planner knows
+    void updateVertex(uint32_t node) {
+        Node& n = nodes[node];
+        if (n.gx != goalGx || n.gy != goalGy) {
+            float best = infinity;
+            unsigned walls = wallNeighborhood(n.gx, n.gy);
+            if (!(walls & (1u << 4))) {
+                for (int k = 0; k < 8; ++k) {
+                    if (!edgeOpen(walls, neighborOffsets[k][0], neighborOffsets[k][1])) continue;
+                    uint32_t s = find(n.gx + neighborOffsets[k][0], n.gy + neighborOffsets[k][1]);
+                    if (s != noNode) best = std::min(best, stepCosts[k] + nodes[s].g);
+                }
+            }
+            nodes[node].rhs = best;
+        }
+        settle(node);
+    }
+
+    // walls is wallNeighborhood of the cell the edge leaves from
+    static bool edgeOpen(unsigned walls, int dx, int dy) {
+        auto wallAt = [walls](int x, int y) { return (walls >> ((x + 1) * 3 + y + 1)) & 1; };
+        if (wallAt(dx, dy)) return false;
+        return dx == 0 || dy == 0 || !(wallAt(dx, 0) || wallAt(0, dy));
+    }
+
+    // An edit at (gx, gy) changes only edges between cells of the 3x3 around it. A cell the
+    // planner never created has g = rhs = infinity and only gains a finite rhs through one of
+    // those edges from a cell it did create, so nothing needs doing unless one of the nine exists.
+    void applyEdit(int gx, int gy) {
+        bool known = false;
+        for (int dx = -1; dx <= 1 && !known; ++dx) {
+            for (int dy = -1; dy <= 1 && !known; ++dy) known = find(gx + dx, gy + dy) != noNode;
+        }
+        if (!known) return;
+        for (int dx = -1; dx <= 1; ++dx) {
+            for (int dy = -1; dy <= 1; ++dy) updateVertex(nodeAt(gx + dx, gy + dy));
+        }
+    }
+
+public:
+    int getGoalGx() const { return goalGx; }
+    int getGoalGy() const { return goalGy; }
+    size_t size() const { return nodes.size(); }
+
+    // forgets everything, plans towards (gx, gy) from here on
+    void reset(int gx, int gy, int fromGx, int fromGy) {
+        nodes.clear();
+        heap.clear();
+        slots.assign(256, 0);
+        pendingEdits.clear();
+        goalGx = gx;
+        goalGy = gy;
+        startGx = fromGx;
+        startGy = fromGy;
+        km = 0.f;
+        uint32_t goal = nodeAt(gx, gy);
+        nodes[goal].rhs = 0.f;
+        enqueue(goal);
+    }
+
+    // a wall changed, folded in on the next plan
+    void wallChanged(int gx, int gy) {
+        pendingEdits.emplace_back(gx, gy);
+    }
+
+    // Brings the costs up to date for a waffle at (gx, gy). False if the goal can't be reached from
+    // there or the search ran past its budget; the planner is still consistent in the first case.
+    bool plan(int gx, int gy, uint32_t& expansions) {
+        if (slots.empty()) return false;
+        km += heuristic(startGx, startGy, gx, gy);
+        startGx = gx;
+        startGy = gy;
+        for (auto [ex, ey] : pendingEdits) applyEdit(ex, ey);
+        pendingEdits.clear();
+
+        // Keys of cells on a straight run to the start tie with the start's key in exact arithmetic,
+        // and rounding in the summed costs can put them a hair above it. Near-ties keep the search
+        // going instead of ending it with such a cell still queued.
+        auto beforeStart = [&](uint32_t start) {
+            Key top = nodes[heap[0]].key;
+            Key limit = keyOf(start);
+            return top.k1 <= limit.k1 + 1e-4f * std::max(1.f, limit.k1) || nodes[start].rhs != nodes[start].g;
+        };
+
+        uint32_t start = nodeAt(gx, gy);
+        expansions = 0;
+        while (!heap.empty() && beforeStart(start)) {
+            if (++expansions > repairMaxExpansions || nodes.size() > repairMaxNodes) return false;
+
+            uint32_t u = heap[0];
+            Key oldKey = nodes[u].key;
+            Key newKey = keyOf(u);
+            if (oldKey < newKey) {
+                enqueue(u); // km moved on since it was queued
+            }
+            else if (nodes[u].g > nodes[u].rhs) {
+                // cheaper: neighbours can only get cheaper through it. Those behind a blocked edge
+                // don't gain anything, so they aren't even created.
+                float g = nodes[u].g = nodes[u].rhs;
+                dequeue(u);
+                int ux = nodes[u].gx, uy = nodes[u].gy;
+                unsigned walls = wallNeighborhood(ux, uy);
+                for (int k = 0; k < 8; ++k) {
+                    if (!edgeOpen(walls, neighborOffsets[k][0], neighborOffsets[k][1])) continue;
+                    uint32_t s = nodeAt(ux + neighborOffsets[k][0], uy + neighborOffsets[k][1]);
+                    if (nodes[s].gx == goalGx && nodes[s].gy == goalGy) continue;
+                    if (stepCosts[k] + g < nodes[s].rhs) {
+                        nodes[s].rhs = stepCosts[k] + g;
+                        settle(s);
+                    }
+                }
+            }
+            else {
+                // dearer: only neighbours whose rhs came through it need a full recount
+                float oldG = nodes[u].g;
+                nodes[u].g = infinity;
+                updateVertex(u);
+                int ux = nodes[u].gx, uy = nodes[u].gy;
+                for (int k = 0; k < 8; ++k) {
+                    uint32_t s = find(ux + neighborOffsets[k][0], uy + neighborOffsets[k][1]);
+                    if (s != noNode && nodes[s].rhs == stepCosts[k] + oldG) updateVertex(s);
+                }
+            }
+        }
+        return nodes[start].g != infinity;
+    }
+
+    // cells from the last plan's start to the goal, each step to the neighbour with the least
+    // step cost + g
+    bool extract(std::vector<std::pair<int, int>>& cells) const {
+        cells.clear();
+        int x = startGx, y = startGy;
+        cells.emplace_back(x, y);
+        for (size_t steps = 0; x != goalGx || y != goalGy; ++steps) {
+            if (steps > nodes.size()) return false; // stale costs, shouldn't happen after plan()
+
+            unsigned walls = wallNeighborhood(x, y);
+            float best = infinity;
+            int bestX = x, bestY = y;
+            for (int k = 0; k < 8; ++k) {
+                if (!edgeOpen(walls, neighborOffsets[k][0], neighborOffsets[k][1])) continue;
+                uint32_t s = find(x + neighborOffsets[k][0], y + neighborOffsets[k][1]);
+                if (s == noNode) continue;
+                float cost = stepCosts[k] + nodes[s].g;
+                if (cost < best) {
+                    best = cost;
+                    bestX = x + neighborOffsets[k][0];
+                    bestY = y + neighborOffsets[k][1];
+                }
+            }
+            if (best == infinity) return false;
+            x = bestX;
+            y = bestY;
+            cells.emplace_back(x, y);
+        }
+        return true;
+    }
+};
+/* --------------------------------------------------------------------------------------------------- */
+
+/* path search checks -------------------------------------------------------------------------------- */
+const int pathCheckSpan = 48;          // cells per side of the scrambled area
+const int pathCheckWallPercent = 25;   // of its cells walled on every scramble
+const uint32_t pathCheckScrambleEvery = 16;
+
+// xorshift32 like the loopback network, so a seed checks the same maps everywhere
+struct PathCheckRandom {
+    uint32_t state;
+
+    explicit PathCheckRandom(uint32_t seed) : state(seed * 2654435761u | 1u) {}
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    int below(int n) { return static_cast<int>(next() % static_cast<uint32_t>(n)); }
+};
+
+// Fresh edits over the checked area, a quarter of it walled, inside a closed ring of walls so a
+// search for a cut-off goal floods the area and not the whole map.
+static void scramblePathCheckWalls(PathCheckRandom& random) {
+    clearWallEdits();
+    for (int gy = -1; gy <= pathCheckSpan; ++gy) {
+        for (int gx = -1; gx <= pathCheckSpan; ++gx) {
+            bool ring = gx < 0 || gy < 0 || gx == pathCheckSpan || gy == pathCheckSpan;
+            setWallCell(gx, gy, ring || random.below(100) < pathCheckWallPercent);
+        }
+    }
+    syncWallCache();
+}
+
+// an open cell of the checked area
+static std::pair<int, int> openPathCheckCell(PathCheckRandom& random) {
+    for (;;) {
+        int gx = random.below(pathCheckSpan), gy = random.below(pathCheckSpan);
+        if (!isWall(gx, gy)) return { gx, gy };
+    }
+}
+
+// summed step costs, or -1 if the cells don't run from start to goal in open steps
+static float checkedPathCost(const std::vector<std::pair<int, int>>& cells, int startGx, int startGy, int goalGx, int goalGy) {
+    if (cells.empty() || cells.front() != std::make_pair(startGx, startGy) || cells.back() != std::make_pair(goalGx, goalGy)) return -1.f;
+    float cost = 0.f;
+    for (size_t k = 1; k < cells.size(); ++k) {
+        auto [ax, ay] = cells[k - 1];
+        auto [bx, by] = cells[k];
+        if (!stepOpen(ax, ay, bx, by)) return -1.f;
+        cost += heuristic(ax, ay, bx, by);
+    }
+    return cost;
+}
+
+static bool sameCost(float a, float b) {
+    return std::abs(a - b) <= 1e-3f * std::max(1.f, a);
+}
+
+// start to goal with every neighbour expanded, the reference the other searches are held to
+static bool referencePath(AstarContext& context, int startGx, int startGy, int goalGx, int goalGy, std::vector<std::pair<int, int>>& cells) {
+    cells.clear();
+    if (!context.search(startGx, startGy, goalGx, goalGy, PathSearchMode::AStar)) return false;
+    context.tracePath([&](int gx, int gy) { cells.emplace_back(gx, gy); });
+    std::reverse(cells.begin(), cells.end());
+    return true;
+}
+
+PathCheckStats checkJumpPointSearch(uint32_t seed, uint32_t queries) {
+    PathCheckRandom random(seed);
+    AstarContext reference, jumpPoint;
+    std::vector<std::pair<int, int>> expected, found;
+    PathCheckStats stats;
+
+    for (uint32_t q = 0; q < queries; ++q) {
+        if (q % pathCheckScrambleEvery == 0) scramblePathCheckWalls(random);
+        auto [sx, sy] = openPathCheckCell(random);
+        auto [gx, gy] = openPathCheckCell(random);
+
+        bool expectedOk = referencePath(reference, sx, sy, gx, gy, expected);
+        found.clear();
+        bool foundOk = jumpPoint.search(sx, sy, gx, gy, PathSearchMode::JumpPoint);
+        if (foundOk) {
+            jumpPoint.tracePath([&](int x, int y) { found.emplace_back(x, y); });
+            std::reverse(found.begin(), found.end());
+        }
+
+        ++stats.checks;
+        float expectedCost = expectedOk ? checkedPathCost(expected, sx, sy, gx, gy) : -1.f;
+        float foundCost = foundOk ? checkedPathCost(found, sx, sy, gx, gy) : -1.f;
+        if (expectedOk != foundOk || (foundOk && (foundCost < 0.f || !sameCost(foundCost, expectedCost)))) {
+            if (++stats.mismatches <= 5) {
+                std::cerr << "jump point search (" << sx << ", " << sy << ") -> (" << gx << ", " << gy << "): cost "
+                    << foundCost << ", A* " << expectedCost << "\n";
+            }
+        }
+    }
+    clearWallEdits();
+    syncWallCache();
+    return stats;
+}
+
+PathCheckStats checkPathRepair(uint32_t seed, uint32_t trials) {
+    const int movesPerTrial = 10;
+    const int editsPerMove = 3;
+    PathCheckRandom random(seed);
+    AstarContext reference;
+    std::vector<std::pair<int, int>> expected, found;
+    PathCheckStats stats;
+
+    for (uint32_t t = 0; t < trials; ++t) {
+        scramblePathCheckWalls(random);
+        auto [sx, sy] = openPathCheckCell(random);
+        auto [gx, gy] = openPathCheckCell(random);
+        DStarLite planner;
+        planner.reset(gx, gy, sx, sy);
+
+        for (int move = 0; move < movesPerTrial; ++move) {
+            uint32_t expansions;
+            bool foundOk = planner.plan(sx, sy, expansions) && planner.extract(found);
+            bool expectedOk = referencePath(reference, sx, sy, gx, gy, expected);
+
+            ++stats.checks;
+            float expectedCost = expectedOk ? checkedPathCost(expected, sx, sy, gx, gy) : -1.f;
+            float foundCost = foundOk ? checkedPathCost(found, sx, sy, gx, gy) : -1.f;
+            if (expectedOk != foundOk || (foundOk && (foundCost < 0.f || !sameCost(foundCost, expectedCost)))) {
+                if (++stats.mismatches <= 5) {
+                    std::cerr << "path repair trial " << t << " move " << move << " (" << sx << ", " << sy << ") -> ("
+                        << gx << ", " << gy << "): cost " << foundCost << ", A* " << expectedCost << "\n";
+                }
+            }
+
+            // walls toggled next to the current path, where they change it, then a step aside
+            for (int k = 0; k < editsPerMove; ++k) {
+                std::pair<int, int> near = foundOk && found.size() > 2 ? found[1 + random.below(static_cast<int>(found.size()) - 2)] : openPathCheckCell(random);
+                int wx = near.first + random.below(3) - 1;
+                int wy = near.second + random.below(3) - 1;
+                if (wx < 0 || wy < 0 || wx >= pathCheckSpan || wy >= pathCheckSpan) continue;
+                if ((wx == sx && wy == sy) || (wx == gx && wy == gy)) continue;
+                setWallCell(wx, wy, !isWall(wx, wy));
+                syncWallCache();
+                planner.wallChanged(wx, wy);
+            }
+            int nx = sx + random.below(3) - 1;
+            int ny = sy + random.below(3) - 1;
+            if (nx >= 0 && ny >= 0 && nx < pathCheckSpan && ny < pathCheckSpan && !isWall(nx, ny)) {
+                sx = nx;
+                sy = ny;
+            }
+        }
+    }
+    clearWallEdits();
+    syncWallCache();
+    return stats;
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* flow fields -------------------------------------------------------------------------------------- */
+const int flowFieldMinGroup = 4;    // smaller groups just run A* per unit
+const int flowFieldMargin = 8;      // cells of slack around the group so detours fit in the window
+const int flowFieldMaxSpan = 256;   // wider orders fall back to A* per unit
+
+// One Dijkstra from the goal cell over a bounded window of the map. Every cell in the window
+// stores the step towards the goal, so any unit inside it (late joiners, or units shoved
+// around by waffleCollisions) can read its next waypoint without searching.
+class FlowField {
+private:
+    int originGx = 0, originGy = 0;
+    int width = 0, height = 0;
+    int goalGx = 0, goalGy = 0;
+    std::vector<float> dist;     // cost to goal, infinity if unreachable
+    std::vector<int8_t> nextDir; // index into neighborOffsets, -1 for the goal or unreachable cells
+
+    int indexOf(int gx, int gy) const { return (gy - originGy) * width + (gx - originGx); }
+
+public:
+    int getGoalGx() const { return goalGx; }
+    int getGoalGy() const { return goalGy; }
+
+    bool contains(int gx, int gy) const {
+        return gx >= originGx && gy >= originGy && gx < originGx + width && gy < originGy + height;
+    }
+
+    bool isReachable(int gx, int gy) const {
+        return contains(gx, gy) && dist[indexOf(gx, gy)] != std::numeric_limits<float>::infinity();
+    }
+
+    // cost from (gx, gy) to the goal, infinity outside the window or cut off
+    float distance(int gx, int gy) const {
+        return contains(gx, gy) ? dist[indexOf(gx, gy)] : std::numeric_limits<float>::infinity();
+    }
+
+    // goalWorld is resolved the same way as findPathAstar, including the wall fallback.
+    // [minGx, maxGx] x [minGy, maxGy] is the window. Returns false if the goal has no free cell.
+    bool build(const sf::Vector2f& goalWorld, int minGx, int minGy, int maxGx, int maxGy) {
+        PROFILE_ZONE("flow field");
+        syncWallCache();
+        goalGx = static_cast<int>(std::floor(goalWorld.x / gridSize));
+        goalGy = static_cast<int>(std::floor(goalWorld.y / gridSize));
+        if (!resolveGoalCell(goalGx, goalGy)) return false;
+
+        originGx = std::min(minGx, goalGx);
+        originGy = std::min(minGy, goalGy);
+        width = std::max(maxGx, goalGx) - originGx + 1;
+        height = std::max(maxGy, goalGy) - originGy + 1;
+
+        size_t cells = static_cast<size_t>(width) * height;
+        dist.assign(cells, std::numeric_limits<float>::infinity());
+        nextDir.assign(cells, -1);
+
+        // copy the walls out once up front, the search looks at each cell up to 8 times
+        std::vector<uint8_t> wall(cells);
+        for (int y = 0; y < height; ++y) {
+            for (int x0 = 0; x0 < width; x0 += 64) {
+                uint64_t bits = wallRow(originGx + x0, originGy + y);
+                for (int x = x0; x < std::min(width, x0 + 64); ++x) {
+                    wall[y * width + x] = (bits >> (x - x0)) & 1;
+                }
+            }
+        }
+        auto blocked = [&](int gx, int gy) {
+            return !contains(gx, gy) || wall[indexOf(gx, gy)];
+        };
+
+        struct PQItem {
+            float d;
+            int index;
+            bool operator<(PQItem const& o) const { return d > o.d; } // min-heap
+        };
+        std::priority_queue<PQItem> open;
+        dist[indexOf(goalGx, goalGy)] = 0.f;
+        open.push({ 0.f, indexOf(goalGx, goalGy) });
+
+        while (!open.empty()) {
+            PQItem top = open.top();
+            open.pop();
+            if (top.d > dist[top.index]) continue; // stale entry
+
+            int cx = originGx + top.index % width;
+            int cy = originGy + top.index / width;
+
+            for (int k = 0; k < 8; ++k) {
+                int dx = neighborOffsets[k][0];
+                int dy = neighborOffsets[k][1];
+                int ngx = cx + dx;
+                int ngy = cy + dy;
+                if (blocked(ngx, ngy)) continue;
+
+                // same corner cutting rule as A*, the corner cells are shared by both directions
+                if (dx != 0 && dy != 0 && (blocked(cx + dx, cy) || blocked(cx, cy + dy))) continue;
+
+                float nd = top.d + heuristic(cx, cy, ngx, ngy);
+                int ni = indexOf(ngx, ngy);
+                if (nd < dist[ni]) {
+                    dist[ni] = nd;
+                    nextDir[ni] = static_cast<int8_t>(7 - k); // opposite direction, back towards c
+                    open.push({ nd, ni });
+                }
+            }
+        }
+        return true;
+    }
+
+    // Center of the next cell on the way to the goal. False if (gx, gy) is the goal cell,
+    // outside the window or cut off from the goal.
+    bool nextWaypoint(int gx, int gy, sf::Vector2f& out) const {
+        if (!contains(gx, gy)) return false;
+        int dir = nextDir[indexOf(gx, gy)];
+        if (dir < 0) return false;
+        out = gridToWorldCoord(gx + neighborOffsets[dir][0], gy + neighborOffsets[dir][1]);
+        return true;
+    }
+};
+/* --------------------------------------------------------------------------------------------------- */
+
+/* async pathfinding --------------------------------------------------------------------------------- */
+enum class PathJob : uint8_t {
+    Path,      // A* for one waffle
+    FlowField, // one field for a whole group order
+};
+
+struct PathRequest { // trivially copyable so it can live in the lock-free queue
+    PathJob job;
+    Entity waffle;      // Path jobs
+    size_t orderId;     // FlowField jobs, the group order waiting on the field
+    uint32_t serial;    // WaffleStore::pathSerial at request time, stale results are dropped
+    sf::Vector2f start;
+    sf::Vector2f goal;
+    int minGx, minGy, maxGx, maxGy; // FlowField window
+};
+
+struct PathResult {
+    PathJob job;
+    Entity waffle;
+    size_t orderId;
+    uint32_t serial;
+    sf::Vector2f goal;
+    uint32_t wallEpoch; // when the job started, a result from before the latest wall edit is stale
+    std::deque<sf::Vector2f> path; // empty if no path was found
+    std::shared_ptr<const FlowField> flowField; // null if the goal had no free cell
+};
+
+// Worker pool that runs findPathAstar off the main thread. The main loop pushes requests and
+// picks finished paths up once per frame with collect(), so input and rendering never wait on A*.
+// findPathAstar only reads the map, through the worker's own wall cache, so workers need no
+// shared state beyond the queues and the path cache.
+class PathService {
+private:
+    boost::lockfree::queue<PathRequest> requests;
+    boost::lockfree::queue<PathResult*> results;
+    boost::thread_group workers;
+
+    // idle workers sleep here instead of spinning on an empty queue
+    boost::mutex wakeMutex;
+    boost::condition_variable wake;
+    std::atomic<int> queued{ 0 };
+    std::atomic<bool> stopping{ false };
+    bool inlineJobs;
+    bool cachePaths;
+
+    static PathResult* runJob(const PathRequest& req, bool cachePaths) {
+        uint32_t epoch = wallEpoch.load(std::memory_order_acquire);
+        auto* res = new PathResult{ req.job, req.waffle, req.orderId, req.serial, req.goal, epoch, {}, nullptr };
+        if (req.job == PathJob::FlowField) {
+            auto field = std::make_shared<FlowField>();
+            if (field->build(req.goal, req.minGx, req.minGy, req.maxGx, req.maxGy)) {
+                res->flowField = std::move(field);
+            }
+        }
+        else {
+            res->path = findPathAstar(req.start, req.goal, cachePaths);
+        }
+        return res;
+    }
+
+    void workerLoop() {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(wakeMutex);
+                wake.wait(lock, [this] { return queued.load() > 0 || stopping.load(); });
+                if (stopping.load()) return;
+            }
+
+            PathRequest req;
+            while (requests.pop(req)) {
+                --queued;
+                results.push(runJob(req, cachePaths));
+                if (stopping.load()) return;
+            }
+        }
+    }
+
+public:
+    // inlineJobs runs every request on the calling thread inside request(), no workers are started
+    explicit PathService(unsigned workerCount = 0, bool inlineJobs = false, bool cachePaths = true) :
+        requests(256), results(256), inlineJobs(inlineJobs), cachePaths(cachePaths) {
+        if (inlineJobs) return;
+        if (workerCount == 0) {
+            // leave a core for the main loop
+            unsigned hw = boost::thread::hardware_concurrency();
+            workerCount = hw > 1 ? hw - 1 : 1;
+        }
+        for (unsigned i = 0; i < workerCount; ++i) {
+            workers.create_thread([this, i] {
+                profileThreadName("path worker " + std::to_string(i));
+                workerLoop();
+            });
+        }
+    }
+
+    ~PathService() {
+        {
+            boost::lock_guard<boost::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        workers.join_all();
+
+        PathResult* res;
+        while (results.pop(res)) delete res;
+    }
+
+    PathService(const PathService&) = delete;
+    PathService& operator=(const PathService&) = delete;
+
+    void requestPath(Entity waffle, uint32_t serial, const sf::Vector2f& start, const sf::Vector2f& goal) {
+        request({ PathJob::Path, waffle, 0, serial, start, goal, 0, 0, 0, 0 });
+    }
+
+    void requestFlowField(size_t orderId, const sf::Vector2f& goal, int minGx, int minGy, int maxGx, int maxGy) {
+        request({ PathJob::FlowField, nullEntity, orderId, 0, goal, goal, minGx, minGy, maxGx, maxGy });
+    }
+
+    void request(const PathRequest& req) {
+        if (inlineJobs) {
+            results.push(runJob(req, cachePaths));
+            return;
+        }
+        requests.push(req);
+        {
+            boost::lock_guard<boost::mutex> lock(wakeMutex);
+            ++queued;
+        }
+        wake.notify_one();
+    }
+
+    // hands every finished path to fn(PathResult&), call from the main loop
+    template <typename Fn>
+    void collect(Fn&& fn) {
+        PathResult* raw;
+        while (results.pop(raw)) {
+            std::unique_ptr<PathResult> res(raw);
+            fn(*res);
+        }
+    }
+};
+/* --------------------------------------------------------------------------------------------------- */
+
+// Entity ids filed by grid cell, stored flat: rebuild() counting-sorts every entity into
+// contiguous buckets (cell hash -> [bucketStart[b], bucketStart[b + 1]) of entries), so queries
+// walk spans and nothing allocates once the arrays have grown to the entity count.
+// The map is unbounded, so cells are hashed into a power-of-two bucket table and entries keep
+// their cell coords to filter out collisions.
+// addToCell/removeFromCell still work between rebuilds: an entity that changes cell is parked in
+// a small overflow list until the next rebuild, and its rebuild-time entry goes stale.
+class FlatEntityGrid {
+private:
+    struct Cell {
+        int gx = INT_MIN;
+        int gy = INT_MIN;
+        bool operator==(const Cell& o) const { return gx == o.gx && gy == o.gy; }
+    };
+    struct Entry {
+        Cell cell;
+        uint32_t id;
+    };
+    static constexpr uint32_t noSlot = UINT32_MAX;
+
+    std::vector<uint32_t> bucketStart;  // size bucketMask + 2
+    std::vector<uint32_t> bucketCursor;
+    std::vector<Entry> entries;         // sorted by bucket, ascending id within a bucket
+    std::vector<Entry> overflow;        // entities that changed cell since rebuild
+    std::vector<Cell> homeCell;         // cell each id was sorted under
+    std::vector<Cell> currentCell;      // live cell of each id
+    std::vector<uint32_t> overflowSlot; // index into overflow, or noSlot
+    uint32_t bucketMask = 0;
+    float cellSize;
+
+    uint32_t bucketOf(int gx, int gy) const {
+        uint32_t h = static_cast<uint32_t>(gx) * 73856093u ^ static_cast<uint32_t>(gy) * 19349663u;
+        return h & bucketMask;
+    }
+
+    void ensureId(size_t id) {
+        if (id >= currentCell.size()) {
+            currentCell.resize(id + 1);
+            homeCell.resize(id + 1);
+            overflowSlot.resize(id + 1, noSlot);
+        }
+    }
+
+    template <typename Fn>
+    void forEachInCell(int gx, int gy, Fn& fn) const {
+        Cell cell{ gx, gy };
+        uint32_t b = bucketOf(gx, gy);
+        for (uint32_t k = bucketStart[b]; k < bucketStart[b + 1]; ++k) {
+            const Entry& e = entries[k];
+            if (e.cell == cell && currentCell[e.id] == cell) fn(size_t(e.id));
+        }
+        for (const Entry& e : overflow) {
+            if (e.cell == cell && currentCell[e.id] == cell) fn(size_t(e.id));
+        }
+    }
+
+public:
+    FlatEntityGrid(float size) : bucketStart(2, 0), cellSize(size) {}
+
+    // cellOf(i) -> std::pair<int, int> grid coords for ids 0..count-1
+    template <typename CellFn>
+    void rebuild(size_t count, CellFn&& cellOf) {
+        uint32_t buckets = 1;
+        while (buckets < count * 2) buckets <<= 1;
+        bucketMask = buckets - 1;
+
+        bucketStart.assign(buckets + 1, 0);
+        currentCell.resize(count);
+        homeCell.resize(count);
+        overflowSlot.assign(count, noSlot);
+        overflow.clear();
+
+        for (size_t i = 0; i < count; ++i) {
+            auto [gx, gy] = cellOf(i);
+            currentCell[i] = homeCell[i] = { gx, gy };
+            ++bucketStart[bucketOf(gx, gy) + 1];
+        }
+        for (uint32_t b = 0; b < buckets; ++b) {
+            bucketStart[b + 1] += bucketStart[b];
+        }
+
+        bucketCursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+        entries.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            const Cell& c = currentCell[i];
+            entries[bucketCursor[bucketOf(c.gx, c.gy)]++] = { c, static_cast<uint32_t>(i) };
+        }
+    }
+
+    void addToCell(int gx, int gy, size_t waffleId) {
+        ensureId(waffleId);
+        Cell cell{ gx, gy };
+        currentCell[waffleId] = cell;
+        if (homeCell[waffleId] == cell) return; // rebuild-time entry is live again
+
+        Entry e{ cell, static_cast<uint32_t>(waffleId) };
+        if (overflowSlot[waffleId] == noSlot) {
+            overflowSlot[waffleId] = static_cast<uint32_t>(overflow.size());
+            overflow.push_back(e);
+        }
+        else {
+            overflow[overflowSlot[waffleId]] = e;
+        }
+    }
+
+    void removeFromCell(int gx, int gy, size_t waffleId) {
+        if (waffleId < currentCell.size() && currentCell[waffleId] == Cell{ gx, gy }) {
+            currentCell[waffleId] = Cell{};
+        }
+    }
+
+    template <typename Fn>
+    void forEachNeighbor(int gx, int gy, Fn&& fn) const {
+        forEachInCells(gx - 1, gy - 1, gx + 1, gy + 1, fn);
+    }
+
+    // every entity filed in [minGx, maxGx] x [minGy, maxGy]
+    template <typename Fn>
+    void forEachInCells(int minGx, int minGy, int maxGx, int maxGy, Fn&& fn) const {
+        for (int gx = minGx; gx <= maxGx; ++gx) {
+            for (int gy = minGy; gy <= maxGy; ++gy) {
+                forEachInCell(gx, gy, fn);
+            }
+        }
+    }
+
+    void queryNeighbors(int gx, int gy, std::vector<size_t>& result) const {
+        result.clear();
+        forEachNeighbor(gx, gy, [&](size_t id) { result.push_back(id); });
+    }
+
+    std::vector<size_t> queryNeighbors(int gx, int gy) const {
+        std::vector<size_t> result;
+        queryNeighbors(gx, gy, result);
+        return result;
+    }
+
+    void clear() {
+        bucketStart.assign(2, 0);
+        bucketMask = 0;
+        entries.clear();
+        overflow.clear();
+        homeCell.clear();
+        currentCell.clear();
+        overflowSlot.clear();
+    }
+};
+
+using SpatialGrid = FlatEntityGrid;
+
+void syncEntityGrid(WaffleStore& waffles, FlatEntityGrid& grid) {
+    for (size_t i = 0; i < waffles.size(); ++i) {
+        waffles.gridX[i] = static_cast<int>(std::floor(waffles.x[i] / gridSize));
+        waffles.gridY[i] = static_cast<int>(std::floor(waffles.y[i] / gridSize));
+    }
+    grid.rebuild(waffles.size(), [&](size_t i) { return std::make_pair(waffles.gridX[i], waffles.gridY[i]); });
+}
+
+bool wouldCollideWithWall(const sf::Vector2f& pos, float radius) { // waffle collision helper
+    int centerGx = static_cast<int>(std::floor(pos.x / gridSize));
+    int centerGy = static_cast<int>(std::floor(pos.y / gridSize));
+
+    // Check 3x3 surrounding grid cells
+    for (unsigned walls = wallNeighborhood(centerGx, centerGy); walls != 0; walls &= walls - 1) {
+        int bit = std::countr_zero(walls);
+        int targetGx = centerGx + bit / 3 - 1;
+        int targetGy = centerGy + bit % 3 - 1;
+
+        float wallX = targetGx * gridSize;
+        float wallY = targetGy * gridSize;
+
+        float closestX = std::max(wallX, std::min(pos.x, wallX + gridSize));
+        float closestY = std::max(wallY, std::min(pos.y, wallY + gridSize));
+
+        sf::Vector2f closestPoint(closestX, closestY);
+        sf::Vector2f diff = pos - closestPoint;
+
+        float distanceSq = diff.x * diff.x + diff.y * diff.y;
+
+        if (distanceSq < radius * radius) {
+            return true; 
+        }
+    }
+    return false;
+}
+
+// Index into candidates of the first one from `from` on that overlaps waffle i, or
+// candidates.size(). Same distance test as the scalar resolver, four candidates at a time.
+static size_t findOverlap(const WaffleStore& waffles, size_t i, const std::vector<size_t>& candidates, size_t from, float minDistance) {
+    const float ix = waffles.x[i];
+    const float iy = waffles.y[i];
+    size_t c = from;
+
+#if WAFFLE_SIMD_SSE2
+    const __m128 vix = _mm_set1_ps(ix);
+    const __m128 viy = _mm_set1_ps(iy);
+    const __m128 vmin = _mm_set1_ps(minDistance);
+    const __m128 veps = _mm_set1_ps(0.01f);
+    for (; c + 4 <= candidates.size(); c += 4) {
+        const size_t* j = candidates.data() + c;
+        __m128 dx = _mm_sub_ps(_mm_setr_ps(waffles.x[j[0]], waffles.x[j[1]], waffles.x[j[2]], waffles.x[j[3]]), vix);
+        __m128 dy = _mm_sub_ps(_mm_setr_ps(waffles.y[j[0]], waffles.y[j[1]], waffles.y[j[2]], waffles.y[j[3]]), viy);
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        int hits = _mm_movemask_ps(_mm_and_ps(_mm_cmplt_ps(distance, vmin), _mm_cmpgt_ps(distance, veps)));
+        if (hits) return c + std::countr_zero(static_cast<unsigned>(hits));
+    }
+#endif
+
+    for (; c < candidates.size(); ++c) {
+        float dx = waffles.x[candidates[c]] - ix;
+        float dy = waffles.y[candidates[c]] - iy;
+        float distance = std::sqrt(dx * dx + dy * dy);
+        if (distance < minDistance && distance > 0.01f) return c;
+    }
+    return c;
+}
+
+// Pushes an overlapping pair apart. The moving (selected) waffle gives way less, and a push that
+// would shove either waffle into a wall goes entirely to the other one.
+static void resolveWaffleOverlap(WaffleStore& waffles, size_t i, size_t j, float waffleRadius) {
+    const float minDistance = waffleRadius * 2.f;
+    sf::Vector2f posI = waffles.pos(i);
+    sf::Vector2f posJ = waffles.pos(j);
+    sf::Vector2f diff = posJ - posI;
+    float distance = std::sqrt(diff.x * diff.x + diff.y * diff.y);
+
+    sf::Vector2f direction(diff.x / distance, diff.y / distance);
+    float overlap = minDistance - distance;
+
+    bool iMoving = waffles.selected[i] != 0;
+    bool jMoving = waffles.selected[j] != 0;
+
+    sf::Vector2f pushI, pushJ;
+    sf::Vector2f correction = 1.67f * direction * overlap;
+    if (iMoving && !jMoving) {
+        pushJ = correction * 0.8f;
+        pushI = correction * -0.2f;
+    }
+    else if (jMoving && !iMoving) {
+        pushI = correction * -0.8f;
+        pushJ = correction * 0.2f;
+    }
+    else {
+        pushI = correction / -2.f;
+        pushJ = correction / 2.f;
+    }
+
+    sf::Vector2f newPosI = posI + pushI;
+    sf::Vector2f newPosJ = posJ + pushJ;
+
+    bool iCanMove = !wouldCollideWithWall(newPosI, waffleRadius);
+    bool jCanMove = !wouldCollideWithWall(newPosJ, waffleRadius);
+
+    if (iCanMove && jCanMove) {
+        // Both move
+        waffles.setPos(i, newPosI);
+        waffles.setPos(j, newPosJ);
+    }
+    else if (iCanMove && !jCanMove) {
+        waffles.setPos(i, posI + -correction);
+    }
+    else if (!iCanMove && jCanMove) {
+        waffles.setPos(j, posJ + correction);
+    }
+}
+
+// Waffles filed in the 3x3 cells around (gx, gy), ascending, leaving out coarse ones: those skip
+// waffle-waffle collisions until they are back at full detail, from both sides of every pair.
+template <typename Grid>
+void collisionCandidates(const WaffleStore& waffles, const Grid& grid, int gx, int gy, std::vector<size_t>& out) {
+    grid.queryNeighbors(gx, gy, out);
+    out.erase(std::remove_if(out.begin(), out.end(), [&](size_t j) { return waffles.coarse[j] != 0; }), out.end());
+    std::sort(out.begin(), out.end());
+}
+
+static void resolveWallOverlap(WaffleStore& waffles, size_t i) {
+    sf::Vector2f pos = waffles.pos(i);
+
+    // find current grid cell 
+    int centerGx = static_cast<int>(std::floor(pos.x / gridSize));
+    int centerGy = static_cast<int>(std::floor(pos.y / gridSize));
+
+    // Check surrounding 3x3 for walls, column by column like the cell loop it replaces
+    for (unsigned walls = wallNeighborhood(centerGx, centerGy); walls != 0; walls &= walls - 1) {
+        int bit = std::countr_zero(walls);
+        int targetGx = centerGx + bit / 3 - 1;
+        int targetGy = centerGy + bit % 3 - 1;
+
+        float wallX = targetGx * gridSize;
+        float wallY = targetGy * gridSize;
+
+        // closest point on the square to the circle center
+        float closestX = std::max(wallX, std::min(pos.x, wallX + gridSize));
+        float closestY = std::max(wallY, std::min(pos.y, wallY + gridSize));
+
+        sf::Vector2f closestPoint(closestX, closestY);
+        sf::Vector2f diff = pos - closestPoint;
+
+        float distanceSq = diff.x * diff.x + diff.y * diff.y;
+
+        if (distanceSq < collisionRadius * collisionRadius) {
+            float distance = std::sqrt(distanceSq);
+
+            // Prevent division by zero
+            if (distance > 0.00000001f) {
+                sf::Vector2f direction(diff.x / distance, diff.y / distance);
+                float overlap = collisionRadius - distance;
+
+                // Hard push out of the wall
+                pos += direction * overlap;
+            }
+        }
+    }
+    waffles.setPos(i, pos);
+}
+
+const float arriveRadius = 67.f;
+
+// Moves every waffle towards its target: waffles further than arriveRadius step by
+// speed * deltaTime and snap onto the target if the step would overshoot. reached[i] is set if
+// the waffle was already within arriveRadius or snapped onto the target this step. Coarse
+// waffles stay put with reached unset.
+void stepMovement(WaffleStore& waffles, float deltaTime, std::vector<uint8_t>& reached) {
+    const size_t n = waffles.size();
+    reached.resize(n);
+    float* x = waffles.x.data();
+    float* y = waffles.y.data();
+    const float* tx = waffles.targetX.data();
+    const float* ty = waffles.targetY.data();
+    const uint8_t* coarse = waffles.coarse.data();
+    size_t i = 0;
+
+#if WAFFLE_SIMD_SSE2
+    const __m128 vArrive = _mm_set1_ps(arriveRadius);
+    const __m128 vSpeed = _mm_set1_ps(speed);
+    const __m128 vDelta = _mm_set1_ps(deltaTime);
+    for (; i + 4 <= n; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i);
+        __m128 py = _mm_loadu_ps(y + i);
+        __m128 qx = _mm_loadu_ps(tx + i);
+        __m128 qy = _mm_loadu_ps(ty + i);
+
+        __m128 dx = _mm_sub_ps(qx, px);
+        __m128 dy = _mm_sub_ps(qy, py);
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        __m128 live = _mm_castsi128_ps(_mm_cmpeq_epi32(
+            _mm_setr_epi32(coarse[i], coarse[i + 1], coarse[i + 2], coarse[i + 3]), _mm_setzero_si128()));
+        __m128 far = _mm_and_ps(live, _mm_cmpgt_ps(distance, vArrive));
+
+        // same operation order as the scalar path: (direction * speed) * deltaTime
+        __m128 mx = _mm_mul_ps(_mm_mul_ps(_mm_div_ps(dx, distance), vSpeed), vDelta);
+        __m128 my = _mm_mul_ps(_mm_mul_ps(_mm_div_ps(dy, distance), vSpeed), vDelta);
+        __m128 step = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(mx, mx), _mm_mul_ps(my, my)));
+        __m128 snap = _mm_and_ps(far, _mm_cmpge_ps(step, distance));
+        __m128 glide = _mm_andnot_ps(snap, far);
+
+        // far & snap -> target, far & !snap -> pos + movement, otherwise unchanged
+        __m128 nx = _mm_or_ps(_mm_and_ps(snap, qx), _mm_or_ps(_mm_and_ps(glide, _mm_add_ps(px, mx)), _mm_andnot_ps(far, px)));
+        __m128 ny = _mm_or_ps(_mm_and_ps(snap, qy), _mm_or_ps(_mm_and_ps(glide, _mm_add_ps(py, my)), _mm_andnot_ps(far, py)));
+        _mm_storeu_ps(x + i, nx);
+        _mm_storeu_ps(y + i, ny);
+
+        int done = _mm_movemask_ps(_mm_and_ps(live, _mm_or_ps(snap, _mm_cmpngt_ps(distance, vArrive))));
+        for (int k = 0; k < 4; ++k) reached[i + k] = (done >> k) & 1;
+    }
+#endif
+
+    for (; i < n; ++i) {
+        if (coarse[i]) {
+            reached[i] = false;
+            continue;
+        }
+        sf::Vector2f direction(tx[i] - x[i], ty[i] - y[i]);
+        float distance = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+        reached[i] = true;
+
+        if (distance > arriveRadius) {
+            direction = sf::Vector2f(direction.x / distance, direction.y / distance);
+            sf::Vector2f movement = direction * speed * deltaTime;
+
+            if (std::sqrt(movement.x * movement.x + movement.y * movement.y) >= distance) {
+                x[i] = tx[i];
+                y[i] = ty[i];
+            }
+            else {
+                x[i] += movement.x;
+                y[i] += movement.y;
+                reached[i] = false;
+            }
+        }
+    }
+}
+
+// Where stepMovement would have taken waffle i over deltaTime, in one go: it covers
+// speed * deltaTime of its path, dropping each waypoint it reaches or comes within arriveRadius
+// of, and stops once its last target is within arriveRadius. True if it used up its path.
+static bool advanceAlongPath(WaffleStore& waffles, size_t i, float deltaTime) {
+    const bool hadPath = waffles.hasPath(i);
+    float budget = speed * deltaTime;
+    sf::Vector2f pos = waffles.pos(i);
+    while (budget > 0.f) {
+        if (waffles.hasPath(i)) waffles.setTarget(i, waffles.pathFront(i));
+        sf::Vector2f direction = waffles.target(i) - pos;
+        float distance = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+        if (distance > arriveRadius) {
+            if (budget < distance) {
+                pos += direction * (budget / distance);
+                break;
+            }
+            pos = waffles.target(i);
+            budget -= distance;
+        }
+        if (!waffles.hasPath(i)) break;
+        waffles.popPathFront(i);
+    }
+    waffles.setPos(i, pos);
+    if (waffles.hasPath(i)) waffles.setTarget(i, waffles.pathFront(i));
+    return hadPath && !waffles.hasPath(i);
+}
+
+/* parallel collisions ------------------------------------------------------------------------------- */
+// Fork-join pool for the collision passes. parallelFor(count, fn) hands every worker (the caller
+// included) an even slice of [0, count); a worker that runs out steals the upper half of another
+// worker's remaining slice. Slices are packed begin/end pairs in one atomic word, so popping and
+// stealing are single CAS operations. Every worker syncs its wall cache as a job starts, so each
+// job reads the map as it is when run() is called, whichever worker takes which task.
+class WorkStealingPool {
+private:
+    struct alignas(64) Slice {
+        std::atomic<uint64_t> bounds{ 0 }; // begin in the low 32 bits, end in the high 32 bits
+    };
+
+    static uint64_t pack(uint32_t begin, uint32_t end) { return uint64_t(end) << 32 | begin; }
+
+    boost::thread_group threads;
+    std::unique_ptr<Slice[]> slices;
+    unsigned workerCount; // threads + the calling thread
+
+    // current job, only written while no worker is inside it
+    void (*job)(void*, size_t) = nullptr;
+    void* jobContext = nullptr;
+    std::atomic<size_t> pending{ 0 };
+
+    boost::mutex jobMutex;
+    boost::condition_variable wake;
+    boost::condition_variable idle;
+    uint64_t generation = 0;
+    unsigned active = 0;
+    bool stopping = false;
+
+    bool pop(unsigned w, size_t& task) {
+        uint64_t bounds = slices[w].bounds.load();
+        while (true) {
+            uint32_t begin = static_cast<uint32_t>(bounds);
+            uint32_t end = static_cast<uint32_t>(bounds >> 32);
+            if (begin >= end) return false;
+            if (slices[w].bounds.compare_exchange_weak(bounds, pack(begin + 1, end))) {
+                task = begin;
+                return true;
+            }
+        }
+    }
+
+    bool steal(unsigned w) {
+        for (unsigned k = 1; k < workerCount; ++k) {
+            Slice& victim = slices[(w + k) % workerCount];
+            uint64_t bounds = victim.bounds.load();
+            while (true) {
+                uint32_t begin = static_cast<uint32_t>(bounds);
+                uint32_t end = static_cast<uint32_t>(bounds >> 32);
+                if (begin >= end) break;
+                uint32_t mid = begin + (end - begin) / 2;
+                if (victim.bounds.compare_exchange_weak(bounds, pack(begin, mid))) {
+                    slices[w].bounds.store(pack(mid, end));
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void work(unsigned w) {
+        size_t task;
+        while (true) {
+            if (pop(w, task)) {
+                job(jobContext, task);
+                pending.fetch_sub(1, std::memory_order_release);
+            }
+            else if (!steal(w)) {
+                return;
+            }
+        }
+    }
+
+    void workerLoop(unsigned w) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(jobMutex);
+                wake.wait(lock, [&] { return generation != seen || stopping; });
+                if (stopping) return;
+                seen = generation;
+                ++active;
+            }
+            syncWallCache();
+            work(w);
+            {
+                boost::lock_guard<boost::mutex> lock(jobMutex);
+                --active;
+            }
+            idle.notify_all();
+        }
+    }
+
+    void run(size_t count, void (*fn)(void*, size_t), void* context) {
+        if (count == 0) return;
+        syncWallCache();
+        if (workerCount == 1 || count == 1) {
+            for (size_t i = 0; i < count; ++i) fn(context, i);
+            return;
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(jobMutex);
+            idle.wait(lock, [this] { return active == 0; }); // stragglers from the last job
+            for (unsigned w = 0; w < workerCount; ++w) {
+                slices[w].bounds.store(pack(static_cast<uint32_t>(count * w / workerCount),
+                    static_cast<uint32_t>(count * (w + 1) / workerCount)));
+            }
+            job = fn;
+            jobContext = context;
+            pending.store(count);
+            ++generation;
+        }
+        wake.notify_all();
+
+        work(0);
+        while (pending.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+public:
+    // threadCount 0 uses one thread per core, the calling thread counts as one
+    explicit WorkStealingPool(unsigned threadCount = 0) {
+        if (threadCount == 0) threadCount = std::max(1u, boost::thread::hardware_concurrency());
+        workerCount = threadCount;
+        slices.reset(new Slice[workerCount]);
+        for (unsigned w = 1; w < workerCount; ++w) {
+            threads.create_thread([this, w] {
+                profileThreadName("collision worker " + std::to_string(w));
+                workerLoop(w);
+            });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            boost::lock_guard<boost::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        threads.join_all();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned size() const { return workerCount; }
+
+    // Runs fn(i) for every i in [0, count) and returns once all of them finished.
+    template <typename Fn>
+    void parallelFor(size_t count, Fn&& fn) {
+        using F = std::remove_reference_t<Fn>;
+        run(count, [](void* context, size_t i) { (*static_cast<F*>(context))(i); },
+            const_cast<void*>(static_cast<const void*>(std::addressof(fn))));
+    }
+};
+
+// Splits the waffles into 9 colors by (gx mod 3, gy mod 3) of their cell. Resolving a cell only
+// touches waffles in its 3x3 neighbourhood, and two cells of the same color are at least 3 cells
+// apart, so all cells of one color can be resolved at once. Cells are grouped into tasks by a
+// hash of their coordinates; a task may hold several same-colored cells, which is harmless since
+// they are independent. Within a task waffles are kept in ascending index order.
+class CollisionSchedule {
+private:
+    std::vector<uint32_t> counts; // per (color, bucket) key
+    uint32_t bucketMask = 0;
+
+    static int colorOf(int gx, int gy) {
+        return ((gx % 3 + 3) % 3) * 3 + (gy % 3 + 3) % 3;
+    }
+
+public:
+    std::vector<uint32_t> order;      // waffle indices grouped by task
+    std::vector<uint32_t> taskStart;  // task t is order[taskStart[t], taskStart[t + 1])
+    size_t colorStart[10] = {};       // tasks of color c are [colorStart[c], colorStart[c + 1])
+
+    // coarse waffles get no task
+    void build(const WaffleStore& waffles) {
+        const size_t n = waffles.size();
+        uint32_t buckets = 1;
+        while (buckets * 4 < n) buckets <<= 1;
+        bucketMask = buckets - 1;
+
+        auto keyOf = [&](size_t i) {
+            int gx = waffles.gridX[i];
+            int gy = waffles.gridY[i];
+            uint32_t h = static_cast<uint32_t>(gx) * 73856093u ^ static_cast<uint32_t>(gy) * 19349663u;
+            return static_cast<uint32_t>(colorOf(gx, gy)) * buckets + (h & bucketMask);
+        };
+
+        // counting sort by key, stable so indices stay ascending inside a task
+        counts.assign(size_t(9) * buckets + 1, 0);
+        size_t live = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (waffles.coarse[i]) continue;
+            ++counts[keyOf(i) + 1];
+            ++live;
+        }
+
+        taskStart.clear();
+        size_t key = 0;
+        for (int color = 0; color < 9; ++color) {
+            colorStart[color] = taskStart.size();
+            for (uint32_t b = 0; b < buckets; ++b, ++key) {
+                if (counts[key + 1] != 0) taskStart.push_back(counts[key]);
+                counts[key + 1] += counts[key];
+            }
+        }
+        colorStart[9] = taskStart.size();
+        taskStart.push_back(static_cast<uint32_t>(live));
+
+        order.resize(live);
+        for (size_t i = 0; i < n; ++i) {
+            if (!waffles.coarse[i]) order[counts[keyOf(i)]++] = static_cast<uint32_t>(i);
+        }
+    }
+};
+
+// Pushes apart overlapping waffles, one color of cells at a time on the pool. Overlapping pairs are
+// closer than 2 * radius < gridSize, so the 3x3 cells around a waffle hold every candidate.
+// Waffles are bucketed by the cell they are in at the start of the pass and stay there until it
+// ends, so pushes are not re-bucketed mid-pass. Each pair is resolved by the task holding its
+// lower-index waffle. The result depends only on the waffles, never on the thread count or on
+// which worker ran which task.
+template <typename Grid>
+void waffleCollisions(WaffleStore& waffles, Grid& grid, float waffleRadius, WorkStealingPool& pool, CollisionSchedule& schedule) {
+    PROFILE_ZONE("waffleCollisions");
+    syncEntityGrid(waffles, grid);
+    schedule.build(waffles);
+
+    const float minDistance = waffleRadius * 2.f;
+    auto resolveTask = [&](size_t t) {
+        static thread_local std::vector<size_t> candidates;
+        int cellGx = INT_MIN, cellGy = INT_MIN;
+        for (uint32_t k = schedule.taskStart[t]; k < schedule.taskStart[t + 1]; ++k) {
+            size_t i = schedule.order[k];
+            if (waffles.gridX[i] != cellGx || waffles.gridY[i] != cellGy) {
+                cellGx = waffles.gridX[i];
+                cellGy = waffles.gridY[i];
+                collisionCandidates(waffles, grid, cellGx, cellGy, candidates);
+            }
+
+            size_t c = std::upper_bound(candidates.begin(), candidates.end(), i) - candidates.begin();
+            while ((c = findOverlap(waffles, i, candidates, c, minDistance)) < candidates.size()) {
+                resolveWaffleOverlap(waffles, i, candidates[c], waffleRadius);
+                ++c;
+            }
+        }
+    };
+
+    for (int color = 0; color < 9; ++color) {
+        size_t first = schedule.colorStart[color];
+        pool.parallelFor(schedule.colorStart[color + 1] - first, [&](size_t t) { resolveTask(first + t); });
+    }
+}
+
+// Wall pushes only touch their own waffle, so blocks of waffles run independently.
+void wallCollisions(WaffleStore& waffles, WorkStealingPool& pool) {
+    PROFILE_ZONE("wallCollisions");
+    const size_t block = 256;
+    pool.parallelFor((waffles.size() + block - 1) / block, [&](size_t b) {
+        size_t end = std::min(waffles.size(), (b + 1) * block);
+        for (size_t i = b * block; i < end; ++i) {
+            if (!waffles.coarse[i]) resolveWallOverlap(waffles, i);
+        }
+    });
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* projectiles --------------------------------------------------------------------------------------- */
+const float projectileSpeed = 2400.f;
+const float projectileRadius = 6.f;
+const float projectileLifetime = 1.5f; // seconds
+const float projectileDamage = 25.f;
+const float waffleMaxHealth = 100.f;
+const size_t projectileCapacity = size_t(1) << 16;
+
+// Fixed-capacity shot storage, structure-of-arrays. Every array is sized to the capacity up front
+// and live shots are kept packed at the front: a shot that ends is replaced by the last live one,
+// so the free slots are simply the tail and firing or expiring never allocates. A shot fired
+// while the pool is full is dropped.
+class ProjectilePool {
+private:
+    size_t count = 0;
+
+public:
+    std::vector<float> x, y, vx, vy, life;
+    std::vector<uint8_t> team;
+    uint64_t dropped = 0;
+
+    ProjectilePool() : x(projectileCapacity), y(projectileCapacity), vx(projectileCapacity),
+        vy(projectileCapacity), life(projectileCapacity), team(projectileCapacity) {}
+
+    size_t size() const { return count; }
+    sf::Vector2f pos(size_t k) const { return { x[k], y[k] }; }
+    sf::Vector2f velocity(size_t k) const { return { vx[k], vy[k] }; }
+
+    void fire(sf::Vector2f from, sf::Vector2f v, uint8_t shooterTeam) {
+        if (count == projectileCapacity) {
+            ++dropped;
+            return;
+        }
+        x[count] = from.x;
+        y[count] = from.y;
+        vx[count] = v.x;
+        vy[count] = v.y;
+        life[count] = projectileLifetime;
+        team[count] = shooterTeam;
+        ++count;
+    }
+
+    void clear() { count = 0; }
+
+    // the last live shot moves into slot k
+    void kill(size_t k) {
+        --count;
+        x[k] = x[count];
+        y[k] = y[count];
+        vx[k] = vx[count];
+        vy[k] = vy[count];
+        life[k] = life[count];
+        team[k] = team[count];
+    }
+};
+
+// Fraction of p0 -> p1 at which the segment enters a wall cell, walking the cells it crosses
+// (Amanatides-Woo), or 2 if it stays clear.
+static float segmentWallHit(sf::Vector2f p0, sf::Vector2f p1) {
+    int gx = static_cast<int>(std::floor(p0.x / gridSize));
+    int gy = static_cast<int>(std::floor(p0.y / gridSize));
+    if (isWall(gx, gy)) return 0.f;
+
+    sf::Vector2f d = p1 - p0;
+    const float inf = std::numeric_limits<float>::infinity();
+    int stepX = d.x > 0.f ? 1 : -1;
+    int stepY = d.y > 0.f ? 1 : -1;
+    float tDeltaX = d.x != 0.f ? gridSize / std::abs(d.x) : inf;
+    float tDeltaY = d.y != 0.f ? gridSize / std::abs(d.y) : inf;
+    float tMaxX = d.x != 0.f ? ((gx + (stepX > 0)) * gridSize - p0.x) / d.x : inf;
+    float tMaxY = d.y != 0.f ? ((gy + (stepY > 0)) * gridSize - p0.y) / d.y : inf;
+
+    while (std::min(tMaxX, tMaxY) <= 1.f) {
+        float t;
+        if (tMaxX < tMaxY) {
+            t = tMaxX;
+            gx += stepX;
+            tMaxX += tDeltaX;
+        }
+        else {
+            t = tMaxY;
+            gy += stepY;
+            tMaxY += tDeltaY;
+        }
+        if (isWall(gx, gy)) return t;
+    }
+    return 2.f;
+}
+
+// Fraction of p0 -> p0 + d at which a circle of radius r moving along it first touches the circle
+// of the same radius around c, 0 if it starts inside, or 2 if it misses.
+static float sweptCircleHit(sf::Vector2f p0, sf::Vector2f d, sf::Vector2f c, float r) {
+    sf::Vector2f m = p0 - c;
+    float cc = m.x * m.x + m.y * m.y - r * r;
+    if (cc <= 0.f) return 0.f;
+    float b = m.x * d.x + m.y * d.y;
+    if (b >= 0.f) return 2.f; // moving away
+    float a = d.x * d.x + d.y * d.y;
+    float disc = b * b - a * cc;
+    if (disc < 0.f) return 2.f;
+    return (-b - std::sqrt(disc)) / a;
+}
+
+// Advances every shot by deltaTime. A shot stops at whatever its swept circle touches first along
+// the step: a wall cell, or a waffle of another team for which canHit(slot) holds. Waffle
+// candidates come from the spatial grid cells around the step, padded by a waffle radius since
+// collision pushes can leave waffles slightly outside the cell they were filed under.
+// onHit(slot) is called once per waffle hit.
+template <typename Grid, typename CanHitFn, typename HitFn>
+void stepProjectiles(ProjectilePool& shots, const WaffleStore& waffles, const Grid& grid, float deltaTime,
+    CanHitFn&& canHit, HitFn&& onHit) {
+    PROFILE_ZONE("projectiles");
+    const float hitRadius = projectileRadius + collisionRadius;
+    const float pad = hitRadius + collisionRadius;
+
+    size_t k = 0;
+    while (k < shots.size()) {
+        sf::Vector2f p0 = shots.pos(k);
+        sf::Vector2f d = shots.velocity(k) * deltaTime;
+        sf::Vector2f p1 = p0 + d;
+
+        float hitT = segmentWallHit(p0, p1);
+        size_t hitSlot = SIZE_MAX;
+        grid.forEachInCells(
+            static_cast<int>(std::floor((std::min(p0.x, p1.x) - pad) / gridSize)),
+            static_cast<int>(std::floor((std::min(p0.y, p1.y) - pad) / gridSize)),
+            static_cast<int>(std::floor((std::max(p0.x, p1.x) + pad) / gridSize)),
+            static_cast<int>(std::floor((std::max(p0.y, p1.y) + pad) / gridSize)),
+            [&](size_t i) {
+                if (waffles.team[i] == shots.team[k]) return;
+                float t = sweptCircleHit(p0, d, waffles.pos(i), hitRadius);
+                // ties go to the lower slot so the result doesn't depend on grid order
+                if (t <= 1.f && (t < hitT || (t == hitT && i < hitSlot)) && canHit(i)) {
+                    hitT = t;
+                    hitSlot = i;
+                }
+            });
+
+        shots.life[k] -= deltaTime;
+        if (hitSlot != SIZE_MAX) {
+            onHit(hitSlot);
+            shots.kill(k);
+        }
+        else if (hitT <= 1.f || shots.life[k] <= 0.f) {
+            shots.kill(k);
+        }
+        else {
+            shots.x[k] = p1.x;
+            shots.y[k] = p1.y;
+            ++k;
+        }
+    }
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* target acquisition -------------------------------------------------------------------------------- */
+const float weaponRange = 1200.f;
+const float weaponCooldown = 0.5f; // seconds between shots
+const uint32_t retargetTicks = 10; // a waffle searches for a new target once every this many ticks
+
+struct NearbyWaffle {
+    size_t slot;
+    float distanceSq;
+};
+
+// Cells at Chebyshev distance exactly r from (gx, gy), as up to four spans
+template <typename Grid, typename Fn>
+void forEachInRing(const Grid& grid, int gx, int gy, int r, Fn&& fn) {
+    if (r == 0) {
+        grid.forEachInCells(gx, gy, gx, gy, fn);
+        return;
+    }
+    grid.forEachInCells(gx - r, gy - r, gx + r, gy - r, fn);
+    grid.forEachInCells(gx - r, gy + r, gx + r, gy + r, fn);
+    grid.forEachInCells(gx - r, gy - r + 1, gx - r, gy + r - 1, fn);
+    grid.forEachInCells(gx + r, gy - r + 1, gx + r, gy + r - 1, fn);
+}
+
+// Every waffle within radius of center that accept(slot) lets through, in grid order.
+// The grid is filed as of the last collision pass, like every query below. Store is anything with
+// x and y columns and a size(): the WaffleStore, or SnapshotPicker's copy of a snapshot.
+template <typename Store, typename Grid, typename Accept>
+void queryRadius(const Store& waffles, const Grid& grid, sf::Vector2f center, float radius,
+    Accept&& accept, std::vector<NearbyWaffle>& out) {
+    out.clear();
+    const float radiusSq = radius * radius;
+    grid.forEachInCells(
+        static_cast<int>(std::floor((center.x - radius) / gridSize)),
+        static_cast<int>(std::floor((center.y - radius) / gridSize)),
+        static_cast<int>(std::floor((center.x + radius) / gridSize)),
+        static_cast<int>(std::floor((center.y + radius) / gridSize)),
+        [&](size_t i) {
+            if (i >= waffles.size()) return;
+            float dx = waffles.x[i] - center.x;
+            float dy = waffles.y[i] - center.y;
+            float distanceSq = dx * dx + dy * dy;
+            if (distanceSq <= radiusSq && accept(i)) out.push_back({ i, distanceSq });
+        });
+}
+
+// The k nearest waffles within maxRadius that accept(slot) lets through, nearest first with ties
+// broken by slot. Rings of cells are searched outwards from center's cell, and the search stops
+// once the next ring can't hold anything closer than the k-th best so far. Ring r is at least
+// (r - 1) * gridSize plus center's distance to its own cell edge away, less pad for waffles pushed
+// out of the cell they were filed under, so in a crowd the answer comes from the first ring or two
+// however large maxRadius is.
+template <typename Store, typename Grid, typename Accept>
+void queryNearest(const Store& waffles, const Grid& grid, sf::Vector2f center, size_t k, float maxRadius, float pad,
+    Accept&& accept, std::vector<NearbyWaffle>& out) {
+    out.clear();
+    if (k == 0) return;
+
+    int gx = static_cast<int>(std::floor(center.x / gridSize));
+    int gy = static_cast<int>(std::floor(center.y / gridSize));
+    float edge = std::min(std::min(center.x - gx * gridSize, (gx + 1) * gridSize - center.x),
+        std::min(center.y - gy * gridSize, (gy + 1) * gridSize - center.y));
+    const float maxSq = maxRadius * maxRadius;
+
+    auto closer = [](const NearbyWaffle& a, const NearbyWaffle& b) {
+        return a.distanceSq < b.distanceSq || (a.distanceSq == b.distanceSq && a.slot < b.slot);
+    };
+
+    for (int r = 0;; ++r) {
+        if (r > 0) {
+            float bound = std::max((r - 1) * gridSize + edge - pad, 0.f);
+            if (bound * bound > maxSq) break;
+            if (out.size() == k && bound * bound > out.back().distanceSq) break;
+        }
+        forEachInRing(grid, gx, gy, r, [&](size_t i) {
+            if (i >= waffles.size()) return;
+            float dx = waffles.x[i] - center.x;
+            float dy = waffles.y[i] - center.y;
+            NearbyWaffle hit{ i, dx * dx + dy * dy };
+            if (hit.distanceSq > maxSq) return;
+            if (out.size() == k && !closer(hit, out.back())) return;
+            if (!accept(i)) return;
+
+            auto at = std::upper_bound(out.begin(), out.end(), hit, closer);
+            if (out.size() == k) out.pop_back(); // at is before the end, so it stays valid
+            out.insert(at, hit);
+        });
+    }
+}
+
+// Which teams have a waffle in each block of presenceBlockCells x presenceBlockCells grid cells,
+// one bit per team. Rebuilt once a tick from the cells waffles were filed under, it lets a
+// team-filtered query skip the ring search when its whole area holds no one it could accept,
+// which is the common case for units far behind their own lines.
+const int presenceBlockCells = 8;
+
+class TeamPresence {
+private:
+    struct Slot {
+        int bx = 0, by = 0;
+        uint32_t stamp = 0; // slot is in use this build if it matches the current stamp
+        uint32_t teams = 0;
+    };
+
+    std::vector<Slot> slots; // open addressing, power-of-two size
+    uint32_t stamp = 0;
+
+    size_t home(int bx, int by) const {
+        uint32_t h = static_cast<uint32_t>(bx) * 73856093u ^ static_cast<uint32_t>(by) * 19349663u;
+        return h & (slots.size() - 1);
+    }
+
+public:
+    void rebuild(const WaffleStore& waffles) {
+        size_t want = 64;
+        while (want < waffles.size() * 2) want <<= 1;
+        if (slots.size() < want) {
+            slots.assign(want, Slot{});
+            stamp = 0;
+        }
+        ++stamp;
+
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            int bx = floorDiv(waffles.gridX[i], presenceBlockCells);
+            int by = floorDiv(waffles.gridY[i], presenceBlockCells);
+            size_t s = home(bx, by);
+            while (slots[s].stamp == stamp && (slots[s].bx != bx || slots[s].by != by)) {
+                s = (s + 1) & (slots.size() - 1);
+            }
+            if (slots[s].stamp != stamp) slots[s] = { bx, by, stamp, 0 };
+            slots[s].teams |= 1u << (waffles.team[i] & 31);
+        }
+    }
+
+    // teams with a waffle in any block touching the square of half-size radius around center
+    uint32_t teamsNear(sf::Vector2f center, float radius) const {
+        if (slots.empty()) return 0; // not built yet
+        const float blockSize = presenceBlockCells * gridSize;
+        int minBx = static_cast<int>(std::floor((center.x - radius) / blockSize));
+        int minBy = static_cast<int>(std::floor((center.y - radius) / blockSize));
+        int maxBx = static_cast<int>(std::floor((center.x + radius) / blockSize));
+        int maxBy = static_cast<int>(std::floor((center.y + radius) / blockSize));
+
+        uint32_t teams = 0;
+        for (int bx = minBx; bx <= maxBx; ++bx) {
+            for (int by = minBy; by <= maxBy; ++by) {
+                for (size_t s = home(bx, by); slots[s].stamp == stamp; s = (s + 1) & (slots.size() - 1)) {
+                    if (slots[s].bx == bx && slots[s].by == by) {
+                        teams |= slots[s].teams;
+                        break;
+                    }
+                }
+            }
+        }
+        return teams;
+    }
+};
+
+// slot of the nearest accepted waffle within maxRadius, or SIZE_MAX
+template <typename Store, typename Grid, typename Accept>
+size_t findNearest(const Store& waffles, const Grid& grid, sf::Vector2f center, float maxRadius, float pad, Accept&& accept) {
+    static thread_local std::vector<NearbyWaffle> nearest;
+    queryNearest(waffles, grid, center, 1, maxRadius, pad, accept, nearest);
+    return nearest.empty() ? SIZE_MAX : nearest[0].slot;
+}
+
+// Every waffle inside [min, max] that accept(slot) lets through, walking the cells the box covers
+// padded by pad, for waffles pushed out of the cell they were filed under. A box over more cells
+// than there are waffles, zoomed far out, is answered by a scan instead.
+template <typename Store, typename Grid, typename Accept>
+void queryBox(const Store& waffles, const Grid& grid, sf::Vector2f min, sf::Vector2f max, float pad,
+    Accept&& accept, std::vector<size_t>& out) {
+    out.clear();
+    auto test = [&](size_t i) {
+        if (i >= waffles.size()) return;
+        if (waffles.x[i] >= min.x && waffles.x[i] <= max.x && waffles.y[i] >= min.y && waffles.y[i] <= max.y && accept(i)) {
+            out.push_back(i);
+        }
+    };
+
+    int minGx = static_cast<int>(std::floor((min.x - pad) / gridSize));
+    int minGy = static_cast<int>(std::floor((min.y - pad) / gridSize));
+    int maxGx = static_cast<int>(std::floor((max.x + pad) / gridSize));
+    int maxGy = static_cast<int>(std::floor((max.y + pad) / gridSize));
+    double cells = (double(maxGx) - minGx + 1) * (double(maxGy) - minGy + 1);
+    if (cells > static_cast<double>(waffles.size())) {
+        for (size_t i = 0; i < waffles.size(); ++i) test(i);
+        return;
+    }
+    grid.forEachInCells(minGx, minGy, maxGx, maxGy, test);
+}
+
+static bool isClickDrag(sf::Vector2f a, sf::Vector2f b) {
+    return std::abs(b.x - a.x) < clickDragLimit && std::abs(b.y - a.y) < clickDragLimit;
+}
+
+// What a Select dragged from a to b picks: the nearest waffle within selectionRadius of a for a
+// click, every waffle in the box otherwise
+template <typename Store, typename Grid>
+void querySelection(const Store& waffles, const Grid& grid, sf::Vector2f a, sf::Vector2f b, float pad, std::vector<size_t>& out) {
+    auto anyone = [](size_t) { return true; };
+    if (isClickDrag(a, b)) {
+        out.clear();
+        size_t nearest = findNearest(waffles, grid, a, selectionRadius, pad, anyone);
+        if (nearest != SIZE_MAX) out.push_back(nearest);
+        return;
+    }
+    queryBox(waffles, grid, { std::min(a.x, b.x), std::min(a.y, b.y) }, { std::max(a.x, b.x), std::max(a.y, b.y) },
+        pad, anyone, out);
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* snapshot picking ---------------------------------------------------------------------------------- */
+struct SnapshotPicker::Index {
+    std::vector<float> x, y;
+    FlatEntityGrid grid{ gridSize };
+
+    size_t size() const { return x.size(); }
+};
+
+SnapshotPicker::SnapshotPicker() : index(std::make_unique<Index>()) {}
+
+SnapshotPicker::~SnapshotPicker() = default;
+
+void SnapshotPicker::rebuild(const WaffleSnapshot& snapshot) {
+    PROFILE_ZONE("picker rebuild");
+    const size_t n = snapshot.positions.size();
+    index->x.resize(n);
+    index->y.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        index->x[i] = snapshot.positions[i].x;
+        index->y[i] = snapshot.positions[i].y;
+    }
+    index->grid.rebuild(n, [&](size_t i) {
+        return std::make_pair(static_cast<int>(std::floor(index->x[i] / gridSize)), static_cast<int>(std::floor(index->y[i] / gridSize)));
+    });
+}
+
+void SnapshotPicker::pick(sf::Vector2f dragStart, sf::Vector2f dragEnd, std::vector<size_t>& out) const {
+    querySelection(*index, index->grid, dragStart, dragEnd, 0.f, out);
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* level of detail ----------------------------------------------------------------------------------- */
+// Waffles nobody can see and nobody is fighting don't need a tick-accurate walk. Outside the view
+// (padded by lodViewMargin) with no enemy team within engagementRadius and no target, a waffle
+// goes coarse: it banks its ticks and spends them every lodTicks ticks with advanceAlongPath,
+// followed by a wall push, and sits out the movement kernel and waffle-waffle collisions. So a
+// march across the far side of the map costs a fraction of one on screen. Entering the view or an
+// engagement promotes it, after it spends what it banked, so it arrives when it would have.
+const uint32_t lodTicks = 4;
+const float lodViewMargin = 2.f * gridSize; // so waffles are back at full detail before they scroll in
+const float engagementRadius = weaponRange * 1.5f;
+/* --------------------------------------------------------------------------------------------------- */
+
+/* formations ---------------------------------------------------------------------------------------- */
+// Every waffle of a move order gets a goal slot of its own, so the group arrives spread out
+// instead of piling onto the click and leaving waffleCollisions to shove the pile apart for
+// seconds. Slots sit on a square lattice formationSpacing apart, nearest the click first, on free
+// cells that connect to the goal cell without leaving the formation's window, so none ends up
+// behind a wall.
+const float formationSpacing = 2.2f * collisionRadius;
+const int formationMaxCells = 64; // half-size of the largest window searched for slots
+
+// count slots around click, nearest first. Empty if the click has no free cell near it.
+static void formationSlots(sf::Vector2f click, size_t count, std::vector<sf::Vector2f>& out) {
+    PROFILE_ZONE("formation");
+    out.clear();
+    int goalGx = static_cast<int>(std::floor(click.x / gridSize));
+    int goalGy = static_cast<int>(std::floor(click.y / gridSize));
+    bool clickFree = !isWall(goalGx, goalGy);
+    if (!resolveGoalCell(goalGx, goalGy)) return;
+    const sf::Vector2f center = clickFree ? click : gridToWorldCoord(goalGx, goalGy);
+
+    // a window with room for the lattice, grown if walls leave too few free cells in it
+    float side = formationSpacing * std::ceil(std::sqrt(static_cast<float>(count)));
+    int radius = static_cast<int>(std::ceil(side / 2.f / gridSize)) + 1;
+    static thread_local std::vector<uint8_t> reached;
+    static thread_local std::vector<std::pair<int, int>> open;
+    for (;; radius *= 2) {
+        radius = std::min(radius, formationMaxCells);
+        const int width = 2 * radius + 1;
+        auto indexOf = [&](int gx, int gy) { return (gy - goalGy + radius) * width + (gx - goalGx + radius); };
+        auto inside = [&](int gx, int gy) { return std::abs(gx - goalGx) <= radius && std::abs(gy - goalGy) <= radius; };
+
+        // cells reachable from the goal cell inside the window, same steps as a path
+        reached.assign(size_t(width) * width, 0);
+        open.assign(1, { goalGx, goalGy });
+        reached[indexOf(goalGx, goalGy)] = 1;
+        for (size_t k = 0; k < open.size(); ++k) {
+            auto [cx, cy] = open[k];
+            for (const auto& offset : neighborOffsets) {
+                int nx = cx + offset[0];
+                int ny = cy + offset[1];
+                if (!inside(nx, ny) || reached[indexOf(nx, ny)] || !stepOpen(cx, cy, nx, ny)) continue;
+                reached[indexOf(nx, ny)] = 1;
+                open.push_back({ nx, ny });
+            }
+        }
+
+        // lattice rings outwards, each ring whole so the formation stays round
+        const int rings = static_cast<int>(radius * gridSize / formationSpacing);
+        for (int r = 0; r <= rings && out.size() < count; ++r) {
+            for (int dy = -r; dy <= r; ++dy) {
+                for (int dx = -r; dx <= r; ++dx) {
+                    if (std::max(std::abs(dx), std::abs(dy)) != r) continue;
+                    sf::Vector2f slot = center + sf::Vector2f(dx * formationSpacing, dy * formationSpacing);
+                    int gx = static_cast<int>(std::floor(slot.x / gridSize));
+                    int gy = static_cast<int>(std::floor(slot.y / gridSize));
+                    if (inside(gx, gy) && reached[indexOf(gx, gy)]) out.push_back(slot);
+                }
+            }
+        }
+        if (out.size() >= count || radius == formationMaxCells) break;
+        out.clear();
+    }
+
+    // round rather than square, ties in lattice order so every run picks the same slots
+    std::stable_sort(out.begin(), out.end(), [&](sf::Vector2f a, sf::Vector2f b) {
+        sf::Vector2f da = a - center, db = b - center;
+        return da.x * da.x + da.y * da.y < db.x * db.x + db.y * db.y;
+    });
+    // a crowd bigger than the free space doubles up on the outer slots
+    for (size_t k = out.size(); k < count && !out.empty(); ++k) out.push_back(out[k % out.size()]);
+    out.resize(std::min(out.size(), count));
+}
+
+// Reorders slots so slots[k] goes to the waffle at from[k], keeping the group's shape: waffles and
+// slots are both sorted front to back along the direction of travel and cut into rows of about
+// sqrt(n), and row by row matched left to right. O(n log n), and unlike handing out the nearest
+// free slot greedily, paths rarely cross and nobody is left with a slot across the formation.
+static void assignSlots(const std::vector<sf::Vector2f>& from, std::vector<sf::Vector2f>& slots) {
+    const size_t n = from.size();
+    if (n < 2 || slots.size() != n) return;
+
+    sf::Vector2f centroid, slotCentroid;
+    for (size_t k = 0; k < n; ++k) {
+        centroid += from[k];
+        slotCentroid += slots[k];
+    }
+    centroid /= static_cast<float>(n);
+    slotCentroid /= static_cast<float>(n);
+    sf::Vector2f forward = slotCentroid - centroid;
+    float length = std::sqrt(forward.x * forward.x + forward.y * forward.y);
+    forward = length > 0.01f ? forward / length : sf::Vector2f(1.f, 0.f);
+    const sf::Vector2f side(-forward.y, forward.x);
+
+    struct Keyed {
+        float along, across;
+        uint32_t index;
+    };
+    static thread_local std::vector<Keyed> waffleKeys, slotKeys;
+    auto key = [&](std::vector<Keyed>& keys, const std::vector<sf::Vector2f>& points, sf::Vector2f origin) {
+        keys.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            sf::Vector2f d = points[k] - origin;
+            keys[k] = { d.x * forward.x + d.y * forward.y, d.x * side.x + d.y * side.y, static_cast<uint32_t>(k) };
+        }
+    };
+    key(waffleKeys, from, centroid);
+    key(slotKeys, slots, slotCentroid);
+
+    auto byAlong = [](const Keyed& a, const Keyed& b) { return a.along != b.along ? a.along < b.along : a.index < b.index; };
+    auto byAcross = [](const Keyed& a, const Keyed& b) { return a.across != b.across ? a.across < b.across : a.index < b.index; };
+    std::sort(waffleKeys.begin(), waffleKeys.end(), byAlong);
+    std::sort(slotKeys.begin(), slotKeys.end(), byAlong);
+
+    const size_t row = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(n))));
+    static thread_local std::vector<sf::Vector2f> assigned;
+    assigned.resize(n);
+    for (size_t first = 0; first < n; first += row) {
+        size_t last = std::min(n, first + row);
+        std::sort(waffleKeys.begin() + first, waffleKeys.begin() + last, byAcross);
+        std::sort(slotKeys.begin() + first, slotKeys.begin() + last, byAcross);
+        for (size_t k = first; k < last; ++k) assigned[waffleKeys[k].index] = slots[slotKeys[k].index];
+    }
+    slots.swap(assigned);
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+/* simulation ---------------------------------------------------------------------------------------- */
+// Waffles following a group order's flow field instead of a path of their own
+struct FlowFieldFollower {
+    std::shared_ptr<const FlowField> field;
+};
+
+// Incremental planner of a waffle on its own path, created at its first repair and kept while
+// the path lasts so later repairs reuse its costs
+struct PathRepair {
+    DStarLite planner;
+};
+
+struct Health {
+    float hp;
+};
+
+struct Combat {
+    Entity target;       // nullEntity while nothing is in range
+    float cooldown = 0.f; // seconds until the weapon is ready
+};
+
+// Simulation state behind the public interface in Simulation.h. Waffles are entities: the hot
+// state lives in the attached WaffleStore, anything only some waffles have lives in registry
+// pools. step() runs the systems below in a fixed order.
+class Simulation::Impl {
+private:
+    Registry registry;
+    WaffleStore waffles;
+    SpatialGrid grid{ gridSize };
+    PathService pathService;
+    WorkStealingPool collisionPool;
+    CollisionSchedule collisionSchedule;
+    ProjectilePool shots;
+    TeamPresence teamPresence;
+    std::vector<Entity> killed; // by this tick's shots, destroyed once the projectile pass is done
+    std::vector<Entity> needsRepair; // paths a wall edit cut, repaired by pathRepairSystem
+    std::vector<Entity> repairLater; // couldn't be repaired this tick, back in needsRepair for the next
+    std::vector<std::pair<int, int>> repairCells;
+    std::vector<sf::Vector2f> repairPath;
+
+    // BuildWall/ClearWall orders of the last tick, in queue order, made at the start of the next
+    struct PendingWall {
+        int gx, gy;
+        bool wall;
+        bool changed;
+    };
+    std::vector<PendingWall> pendingWalls;
+
+    // group move orders waiting on their flow field
+    struct GroupOrder {
+        int clickGx, clickGy;
+        std::vector<std::pair<Entity, uint32_t>> members; // waffle, pathSerial
+    };
+    std::unordered_map<size_t, GroupOrder> groupOrders;
+    size_t nextGroupOrderId = 0;
+
+    // kept so repeat orders to the same cell can skip the search
+    std::shared_ptr<const FlowField> lastFlowField;
+    int lastFlowFieldGx = 0;
+    int lastFlowFieldGy = 0;
+
+    uint64_t tick = 0;
+    uint64_t pathsApplied = 0;
+    uint64_t flowFieldsApplied = 0;
+    uint64_t pathRepairs = 0;
+    uint64_t hits = 0;
+    uint64_t kills = 0;
+    boost::lockfree::queue<SimCommand> commands{ 64 };
+
+    // snapshots: the sim fills back, then swaps it with latest; the renderer swaps latest out
+    WaffleSnapshot back;
+    WaffleSnapshot latest;
+    bool latestFresh = false;
+    boost::mutex snapshotMutex;
+
+    boost::thread thread;
+    std::atomic<bool> running{ false };
+
+    std::vector<uint8_t> reached; // per waffle, filled by stepMovement
+    CommandLog* recording = nullptr;
+    bool lockstep;
+
+    // the renderer's view for the level-of-detail pass, set from the main thread
+    boost::mutex viewMutex;
+    std::optional<sf::FloatRect> view;
+    size_t coarseWaffles = 0;
+
+    bool gridStale = false;      // slots moved since the grid was filed
+    std::vector<size_t> picked; // by select
+    std::vector<sf::Vector2f> slots, memberPositions; // by move
+
+    static uint8_t playerBit(const SimCommand& cmd) {
+        return static_cast<uint8_t>(1u << (cmd.player % simMaxPlayers));
+    }
+
+    // Answered from the grid, see querySelection. Kills and removals since the last collision pass
+    // leave it filed under stale slots, so it is refiled first when they happened.
+    void select(const SimCommand& cmd) {
+        const uint8_t bit = playerBit(cmd);
+        if (gridStale) {
+            syncEntityGrid(waffles, grid);
+            gridStale = false;
+        }
+        querySelection(waffles, grid, cmd.a, cmd.b, collisionRadius, picked);
+
+        // Clear prev selection if not holding shift
+        if (!cmd.additive) {
+            for (uint8_t& mask : waffles.selected) mask &= ~bit;
+        }
+
+        bool isClick = isClickDrag(cmd.a, cmd.b);
+        for (size_t i : picked) {
+            if (isClick) waffles.selected[i] ^= bit;
+            else waffles.selected[i] |= bit;
+        }
+    }
+
+    void move(const SimCommand& cmd) {
+        const sf::Vector2f clickPos = cmd.a;
+        const uint8_t bit = playerBit(cmd);
+        int clickGx = static_cast<int>(std::floor(clickPos.x / gridSize));
+        int clickGy = static_cast<int>(std::floor(clickPos.y / gridSize));
+
+        GroupOrder order{ clickGx, clickGy, {} };
+        int minGx = clickGx, maxGx = clickGx;
+        int minGy = clickGy, maxGy = clickGy;
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            if (waffles.selected[i] & bit) {
+                order.members.emplace_back(waffles.entityAt(i), 0);
+
+                int gx = static_cast<int>(std::floor(waffles.x[i] / gridSize));
+                int gy = static_cast<int>(std::floor(waffles.y[i] / gridSize));
+                minGx = std::min(minGx, gx);
+                maxGx = std::max(maxGx, gx);
+                minGy = std::min(minGy, gy);
+                maxGy = std::max(maxGy, gy);
+            }
+        }
+
+        // one slot each, handed out in member order
+        formationSlots(clickPos, order.members.size(), slots);
+        if (slots.size() != order.members.size()) slots.assign(order.members.size(), clickPos);
+        memberPositions.clear();
+        for (auto [e, serial] : order.members) memberPositions.push_back(waffles.pos(waffles.slotOf(e)));
+        assignSlots(memberPositions, slots);
+        for (sf::Vector2f slot : slots) {
+            int gx = static_cast<int>(std::floor(slot.x / gridSize));
+            int gy = static_cast<int>(std::floor(slot.y / gridSize));
+            minGx = std::min(minGx, gx);
+            maxGx = std::max(maxGx, gx);
+            minGy = std::min(minGy, gy);
+            maxGy = std::max(maxGy, gy);
+        }
+
+        bool groupMove = order.members.size() >= flowFieldMinGroup &&
+            maxGx - minGx + 1 + 2 * flowFieldMargin <= flowFieldMaxSpan &&
+            maxGy - minGy + 1 + 2 * flowFieldMargin <= flowFieldMaxSpan;
+
+        for (size_t k = 0; k < order.members.size(); ++k) {
+            auto& [e, serial] = order.members[k];
+            size_t i = waffles.slotOf(e);
+            serial = ++waffles.pathSerial[i];
+            waffles.orderGoal[i] = slots[k];
+            if (!groupMove && shiftGoal(i, slots[k])) continue;
+
+            // hold position until the worker pool hands the path back
+            waffles.pathPending[i] = 1;
+            waffles.clearPath(i);
+            registry.remove<FlowFieldFollower>(e);
+            registry.remove<PathRepair>(e);
+            waffles.setTarget(i, waffles.pos(i));
+            if (!groupMove) pathService.requestPath(e, serial, waffles.pos(i), slots[k]);
+        }
+
+        if (!groupMove) return;
+
+        auto inLastField = [&](sf::Vector2f p) {
+            return lastFlowField->isReachable(static_cast<int>(std::floor(p.x / gridSize)), static_cast<int>(std::floor(p.y / gridSize)));
+        };
+        if (lastFlowField && lastFlowFieldGx == clickGx && lastFlowFieldGy == clickGy &&
+            std::all_of(memberPositions.begin(), memberPositions.end(), inLastField) &&
+            std::all_of(slots.begin(), slots.end(), inLastField)) {
+            // same goal cell as the last group order and everyone, and every slot, is inside its field
+            for (auto [e, serial] : order.members) {
+                registry.emplace<FlowFieldFollower>(e, lastFlowField);
+                waffles.pathPending[waffles.slotOf(e)] = 0;
+            }
+        }
+        else {
+            size_t orderId = nextGroupOrderId++;
+            pathService.requestFlowField(orderId, clickPos,
+                minGx - flowFieldMargin, minGy - flowFieldMargin,
+                maxGx + flowFieldMargin, maxGy + flowFieldMargin);
+            groupOrders.emplace(orderId, std::move(order));
+        }
+    }
+
+    // A re-click within repairGoalShift cells of waffle i's current goal keeps the path: it is cut
+    // short if it already passes the new goal cell, otherwise only the hop from the old goal cell
+    // to the new one is searched. False if the order needs a fresh path.
+    bool shiftGoal(size_t i, const sf::Vector2f& clickPos) {
+        if (!waffles.hasPath(i)) return false;
+        int goalGx = static_cast<int>(std::floor(clickPos.x / gridSize));
+        int goalGy = static_cast<int>(std::floor(clickPos.y / gridSize));
+        if (!resolveGoalCell(goalGx, goalGy)) return false;
+
+        sf::Vector2f oldGoal = waffles.pathData(i)[waffles.pathLength(i) - 1];
+        int oldGx = static_cast<int>(std::floor(oldGoal.x / gridSize));
+        int oldGy = static_cast<int>(std::floor(oldGoal.y / gridSize));
+        if (std::max(std::abs(goalGx - oldGx), std::abs(goalGy - oldGy)) > repairGoalShift) return false;
+
+        repairPath.assign(waffles.pathData(i), waffles.pathData(i) + waffles.pathLength(i));
+        auto onPath = std::find_if(repairPath.begin(), repairPath.end(), [&](sf::Vector2f p) {
+            return static_cast<int>(std::floor(p.x / gridSize)) == goalGx && static_cast<int>(std::floor(p.y / gridSize)) == goalGy;
+        });
+        if (onPath != repairPath.end()) {
+            repairPath.erase(onPath + 1, repairPath.end());
+        }
+        else {
+            // a short hop, give up long before a full search would
+            if (!findGridPath(oldGx, oldGy, goalGx, goalGy, 64 * repairGoalShift * repairGoalShift, repairCells)) return false;
+            for (size_t k = 1; k < repairCells.size(); ++k) {
+                repairPath.push_back(gridToWorldCoord(repairCells[k].first, repairCells[k].second));
+            }
+        }
+
+        Entity e = waffles.entityAt(i);
+        waffles.setPath(i, repairPath.begin(), repairPath.end());
+        endPathAtGoal(i);
+        waffles.pathPending[i] = 0;
+        registry.remove<PathRepair>(e); // its costs lead to the old goal
+        ++pathRepairs;
+        return true;
+    }
+
+    // Re-plans waffle i's path from where it stands with its planner, which is created on the first
+    // repair and reset if the path's goal moved. A waffle whose planner can't do it cheaply falls
+    // back to a fresh request through the path workers. Returns the expansions spent.
+    uint32_t repairWafflePath(size_t i) {
+        Entity e = waffles.entityAt(i);
+        int gx = static_cast<int>(std::floor(waffles.x[i] / gridSize));
+        int gy = static_cast<int>(std::floor(waffles.y[i] / gridSize));
+        if (isWall(gx, gy)) {
+            repairLater.push_back(e); // pushed out by wallCollisions first, repaired next tick
+            return 0;
+        }
+
+        sf::Vector2f goal = waffles.pathData(i)[waffles.pathLength(i) - 1];
+        int goalGx = static_cast<int>(std::floor(goal.x / gridSize));
+        int goalGy = static_cast<int>(std::floor(goal.y / gridSize));
+
+        PathRepair* repair = registry.tryGet<PathRepair>(e);
+        if (!repair) repair = &registry.emplace<PathRepair>(e);
+        DStarLite& planner = repair->planner;
+        if (planner.size() == 0 || planner.getGoalGx() != goalGx || planner.getGoalGy() != goalGy) {
+            planner.reset(goalGx, goalGy, gx, gy);
+        }
+
+        uint32_t expansions;
+        if (planner.plan(gx, gy, expansions) && planner.extract(repairCells)) {
+            repairPath.clear();
+            for (auto [cx, cy] : repairCells) repairPath.push_back(gridToWorldCoord(cx, cy));
+            waffles.setPath(i, repairPath.begin(), repairPath.end());
+            endPathAtGoal(i);
+            waffles.setTarget(i, waffles.pathFront(i));
+            ++pathRepairs;
+            return expansions;
+        }
+
+        registry.remove<PathRepair>(e);
+        waffles.clearPath(i);
+        waffles.setTarget(i, waffles.pos(i));
+        waffles.pathPending[i] = 1;
+        pathService.requestPath(e, ++waffles.pathSerial[i], waffles.pos(i), goal);
+        return expansions;
+    }
+
+    void shoot(size_t i, const sf::Vector2f& aim) {
+        sf::Vector2f dir = aim - waffles.pos(i);
+        float length = std::sqrt(dir.x * dir.x + dir.y * dir.y);
+        if (length < 0.01f) return;
+        dir /= length;
+        // spawn just outside the shooter
+        sf::Vector2f muzzle = waffles.pos(i) + dir * (collisionRadius + projectileRadius + 1.f);
+        shots.fire(muzzle, dir * projectileSpeed, waffles.team[i]);
+    }
+
+    // every waffle the player has selected fires one shot towards a
+    void fire(const SimCommand& cmd) {
+        const uint8_t bit = playerBit(cmd);
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            if (waffles.selected[i] & bit) shoot(i, cmd.a);
+        }
+    }
+
+    /* systems, in step() order */
+
+    // The wall grid is shared by every Simulation in the process, so a wall order can't change it
+    // mid-tick: a lockstep peer that gets to the order first would hand the wall to peers still
+    // running that tick. Each Simulation makes its own wall orders before anything else on the
+    // next tick instead, when every peer has finished the one they were given on. Every cell goes
+    // in before anything re-routes, as the peers after the first find them all made already.
+    void wallOrderSystem() {
+        for (PendingWall& edit : pendingWalls) edit.changed = changeWallCell(edit.gx, edit.gy, edit.wall);
+        for (const PendingWall& edit : pendingWalls) {
+            if (edit.changed || lockstep) wallChanged(edit.gx, edit.gy, edit.wall);
+        }
+        pendingWalls.clear();
+    }
+
+    // player input queued since the last tick, wall orders wait for wallOrderSystem
+    void commandSystem() {
+        SimCommand cmd;
+        while (commands.pop(cmd)) {
+            if (recording) recording->append(tick, cmd);
+            if (cmd.type == SimCommandType::Select) select(cmd);
+            else if (cmd.type == SimCommandType::Move) move(cmd);
+            else if (cmd.type == SimCommandType::Fire) fire(cmd);
+            else if (cmd.type == SimCommandType::BuildWall || cmd.type == SimCommandType::ClearWall) {
+                pendingWalls.push_back({ static_cast<int>(std::floor(cmd.a.x / gridSize)), static_cast<int>(std::floor(cmd.a.y / gridSize)),
+                    cmd.type == SimCommandType::BuildWall, false });
+            }
+        }
+    }
+
+    // Pick up finished paths. Results name their waffle by Entity, so a waffle removed while its
+    // path was in flight is simply skipped. A result searched before the latest wall edit may run
+    // through the new wall or miss a new gap: a stale path is taken but queued for repair, a stale
+    // "no path" is asked again, and a stale flow field sends its group down paths of their own.
+    void pathResultSystem() {
+        PROFILE_ZONE("collect paths");
+        pathService.collect([&](PathResult& res) {
+            bool stale = res.wallEpoch != wallEpoch.load(std::memory_order_acquire);
+            if (res.job == PathJob::FlowField) {
+                ++flowFieldsApplied;
+                auto it = groupOrders.find(res.orderId);
+                if (it == groupOrders.end()) return;
+                GroupOrder order = std::move(it->second);
+                groupOrders.erase(it);
+
+                if (res.flowField && !stale) {
+                    lastFlowField = res.flowField;
+                    lastFlowFieldGx = order.clickGx;
+                    lastFlowFieldGy = order.clickGy;
+                }
+                for (auto [e, serial] : order.members) {
+                    if (!waffles.has(e)) continue;
+                    size_t i = waffles.slotOf(e);
+                    if (serial != waffles.pathSerial[i]) continue;
+
+                    int gx = static_cast<int>(std::floor(waffles.x[i] / gridSize));
+                    int gy = static_cast<int>(std::floor(waffles.y[i] / gridSize));
+                    if (res.flowField && !stale && res.flowField->isReachable(gx, gy)) {
+                        registry.emplace<FlowFieldFollower>(e, res.flowField);
+                        waffles.pathPending[i] = 0;
+                    }
+                    else {
+                        pathService.requestPath(e, serial, waffles.pos(i), waffles.orderGoal[i]);
+                    }
+                }
+                return;
+            }
+
+            ++pathsApplied;
+            if (!waffles.has(res.waffle)) return;
+            size_t i = waffles.slotOf(res.waffle);
+            if (res.serial != waffles.pathSerial[i]) return; // superseded by a newer order
+
+            waffles.pathPending[i] = 0;
+            if (!res.path.empty()) {
+                waffles.setPath(i, res.path.begin(), res.path.end());
+                endPathAtGoal(i);
+                waffles.setTarget(i, waffles.pathFront(i));
+                if (stale) needsRepair.push_back(res.waffle);
+            }
+            else if (stale) {
+                waffles.pathPending[i] = 1;
+                pathService.requestPath(res.waffle, ++waffles.pathSerial[i], waffles.pos(i), res.goal);
+            }
+            else {
+                waffles.setTarget(i, res.goal);
+            }
+        });
+    }
+
+    // Flow field waypoints, only visits waffles that follow a field. A waffle leaves the field once
+    // it is as close to the goal as its formation slot and nothing walls it off from the slot, and
+    // walks the rest straight. One still walled off at the goal cell paths the rest on its own.
+    void flowFieldSystem() {
+        registry.view<FlowFieldFollower>([&](Entity e, FlowFieldFollower& follower) {
+            const FlowField& field = *follower.field;
+            size_t i = waffles.slotOf(e);
+            int gx = static_cast<int>(std::floor(waffles.x[i] / gridSize));
+            int gy = static_cast<int>(std::floor(waffles.y[i] / gridSize));
+            sf::Vector2f slot = waffles.orderGoal[i];
+            int slotGx = static_cast<int>(std::floor(slot.x / gridSize));
+            int slotGy = static_cast<int>(std::floor(slot.y / gridSize));
+
+            sf::Vector2f waypoint;
+            bool atGoal = gx == field.getGoalGx() && gy == field.getGoalGy();
+            bool lastLeg = atGoal || field.distance(gx, gy) <= field.distance(slotGx, slotGy);
+            if (lastLeg && segmentWallHit(waffles.pos(i), slot) > 1.f) {
+                waffles.setTarget(i, slot);
+                registry.remove<FlowFieldFollower>(e);
+            }
+            else if (!atGoal && field.nextWaypoint(gx, gy, waypoint)) {
+                waffles.setTarget(i, waypoint);
+            }
+            else {
+                // shoved out of the field's window, or walled off from its slot at the goal cell
+                waffles.setTarget(i, waffles.pos(i));
+                waffles.pathPending[i] = 1;
+                pathService.requestPath(e, ++waffles.pathSerial[i], waffles.pos(i), slot);
+                registry.remove<FlowFieldFollower>(e);
+            }
+        });
+    }
+
+    // Paths end on the center of the goal cell; a waffle's ends on its formation slot in that cell.
+    void endPathAtGoal(size_t i) {
+        sf::Vector2f& last = waffles.pathPool[waffles.pathEnd[i] - 1];
+        sf::Vector2f goal = waffles.orderGoal[i];
+        bool sameCell = static_cast<int>(std::floor(last.x / gridSize)) == static_cast<int>(std::floor(goal.x / gridSize)) &&
+            static_cast<int>(std::floor(last.y / gridSize)) == static_cast<int>(std::floor(goal.y / gridSize));
+        if (sameCell) last = goal;
+    }
+
+    void moveCoarse(size_t i) {
+        if (waffles.coarseOwed[i] == 0) return;
+        bool arrived = advanceAlongPath(waffles, i, waffles.coarseOwed[i] * simTickSeconds);
+        waffles.coarseOwed[i] = 0;
+        resolveWallOverlap(waffles, i);
+        if (arrived) registry.remove<PathRepair>(waffles.entityAt(i));
+    }
+
+    // Level of detail, see lodTicks. The view is checked every tick, enemies and targets on the
+    // waffle's retargeting beat of lodTicks (staggered by entity index), using the team presence
+    // targetingSystem built last tick. Off until setView is called, and for lockstep peers, whose
+    // views differ.
+    void lodSystem() {
+        PROFILE_ZONE("level of detail");
+        std::optional<sf::FloatRect> area;
+        {
+            boost::lock_guard<boost::mutex> lock(viewMutex);
+            area = view;
+        }
+        coarseWaffles = 0;
+        if (!area || lockstep) return;
+        area->position -= sf::Vector2f(lodViewMargin, lodViewMargin);
+        area->size += sf::Vector2f(2.f * lodViewMargin, 2.f * lodViewMargin);
+
+        auto& combat = registry.pool<Combat>();
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            Entity e = waffles.entityAt(i);
+            sf::Vector2f pos = waffles.pos(i);
+            bool due = (e.index + tick) % lodTicks == 0;
+            bool calm = !area->contains(pos);
+            if (calm && due) {
+                uint32_t enemies = teamPresence.teamsNear(pos, engagementRadius) & ~(1u << (waffles.team[i] & 31));
+                calm = enemies == 0 && combat.get(e).target == nullEntity;
+            }
+            else if (calm) {
+                calm = waffles.coarse[i] != 0; // full detail until the next beat
+            }
+            if (!calm) {
+                if (waffles.coarse[i]) moveCoarse(i);
+                waffles.coarse[i] = 0;
+                continue;
+            }
+            waffles.coarse[i] = 1;
+            ++coarseWaffles;
+            ++waffles.coarseOwed[i];
+            if (due) moveCoarse(i);
+        }
+    }
+
+    // Movement loop: path fronts become targets, then everyone steps towards their target
+    void movementSystem(float deltaTime) {
+        PROFILE_ZONE("movement");
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            if (waffles.hasPath(i)) {
+                waffles.setTarget(i, waffles.pathFront(i));
+            }
+        }
+
+        stepMovement(waffles, deltaTime, reached);
+
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            if (reached[i] && waffles.hasPath(i)) {
+                waffles.popPathFront(i);
+                if (!waffles.hasPath(i)) registry.remove<PathRepair>(waffles.entityAt(i)); // arrived
+            }
+        }
+    }
+
+    void collisionSystem() {
+        waffleCollisions(waffles, grid, collisionRadius, collisionPool, collisionSchedule);
+        gridStale = false;
+        wallCollisions(waffles, collisionPool);
+    }
+
+    // Paths cut by a wall edit, plus waffles that collisions shoved off their route: standing more
+    // than one step from the next path cell, or where that step would cut a wall corner. Repairs
+    // run in entity order until repairTickBudget expansions are spent, the rest stay queued.
+    void pathRepairSystem() {
+        PROFILE_ZONE("path repair");
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            if (!waffles.hasPath(i)) continue;
+            int gx = static_cast<int>(std::floor(waffles.x[i] / gridSize));
+            int gy = static_cast<int>(std::floor(waffles.y[i] / gridSize));
+            sf::Vector2f front = waffles.pathFront(i);
+            int fx = static_cast<int>(std::floor(front.x / gridSize));
+            int fy = static_cast<int>(std::floor(front.y / gridSize));
+            if ((gx != fx || gy != fy) && !stepOpen(gx, gy, fx, fy)) needsRepair.push_back(waffles.entityAt(i));
+        }
+        if (needsRepair.empty()) return;
+
+        auto byEntity = [](Entity a, Entity b) { return a.index != b.index ? a.index < b.index : a.generation < b.generation; };
+        std::sort(needsRepair.begin(), needsRepair.end(), byEntity);
+        needsRepair.erase(std::unique(needsRepair.begin(), needsRepair.end()), needsRepair.end());
+
+        size_t done = 0;
+        uint32_t spent = 0;
+        for (; done < needsRepair.size() && spent < repairTickBudget; ++done) {
+            Entity e = needsRepair[done];
+            if (!waffles.has(e) || !waffles.hasPath(waffles.slotOf(e))) continue;
+            spent += repairWafflePath(waffles.slotOf(e));
+        }
+        needsRepair.erase(needsRepair.begin(), needsRepair.begin() + done);
+        needsRepair.insert(needsRepair.end(), repairLater.begin(), repairLater.end());
+        repairLater.clear();
+    }
+
+    // Staggered target acquisition: a waffle runs its nearest-enemy query only on ticks where
+    // (entity index + tick) % retargetTicks == 0, so each tick pays for a tenth of the army, and
+    // TeamPresence turns the query away early when no enemy is anywhere near. In between, the
+    // current target is only checked for being alive and in range. Waffles fire at their target
+    // whenever the weapon is ready. Runs before projectileSystem, while the grid still matches
+    // the slots it was filed with.
+    void targetingSystem() {
+        PROFILE_ZONE("targeting");
+        teamPresence.rebuild(waffles);
+
+        const float rangeSq = weaponRange * weaponRange;
+        registry.view<Combat>([&](Entity e, Combat& combat) {
+            size_t i = waffles.slotOf(e);
+            sf::Vector2f pos = waffles.pos(i);
+            uint8_t team = waffles.team[i];
+
+            if ((e.index + tick) % retargetTicks == 0) {
+                // padded since collision pushes can leave waffles outside the cell they were filed under
+                uint32_t enemies = teamPresence.teamsNear(pos, weaponRange + collisionRadius) & ~(1u << (team & 31));
+                size_t nearest = enemies == 0 ? SIZE_MAX :
+                    findNearest(waffles, grid, pos, weaponRange, collisionRadius, [&](size_t j) { return waffles.team[j] != team; });
+                combat.target = nearest == SIZE_MAX ? nullEntity : waffles.entityAt(nearest);
+            }
+            else if (combat.target != nullEntity) {
+                if (!waffles.has(combat.target)) {
+                    combat.target = nullEntity;
+                }
+                else {
+                    sf::Vector2f d = waffles.pos(waffles.slotOf(combat.target)) - pos;
+                    if (d.x * d.x + d.y * d.y > rangeSq) combat.target = nullEntity;
+                }
+            }
+
+            combat.cooldown = std::max(0.f, combat.cooldown - simTickSeconds);
+            if (combat.target != nullEntity && combat.cooldown <= 0.f) {
+                shoot(i, waffles.pos(waffles.slotOf(combat.target)));
+                combat.cooldown = weaponCooldown;
+            }
+        });
+    }
+
+    // Shots fly and hit. Waffles that run out of health are destroyed after the pass, so slots and
+    // the grid stay put while it runs.
+    void projectileSystem() {
+        auto& health = registry.pool<Health>();
+        stepProjectiles(shots, waffles, grid, simTickSeconds,
+            [&](size_t i) { return health.get(waffles.entityAt(i)).hp > 0.f; },
+            [&](size_t i) {
+                ++hits;
+                Entity e = waffles.entityAt(i);
+                float& hp = health.get(e).hp;
+                hp -= projectileDamage;
+                if (hp <= 0.f) killed.push_back(e);
+            });
+
+        for (Entity e : killed) registry.destroy(e);
+        if (!killed.empty()) gridStale = true;
+        kills += killed.size();
+        killed.clear();
+    }
+
+    void snapshotSystem() {
+        PROFILE_ZONE("snapshot");
+        back.tick = tick;
+        back.time = std::chrono::steady_clock::now();
+        back.entities.assign(waffles.set.entities().begin(), waffles.set.entities().end());
+        back.positions.clear();
+        back.selected.clear();
+        back.teams.assign(waffles.team.begin(), waffles.team.end());
+        back.pathPoints.clear();
+        back.pathOffsets.clear();
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            back.positions.push_back(waffles.pos(i));
+            back.selected.push_back(waffles.selected[i]);
+            back.pathOffsets.push_back(static_cast<uint32_t>(back.pathPoints.size()));
+            back.pathPoints.insert(back.pathPoints.end(), waffles.pathData(i), waffles.pathData(i) + waffles.pathLength(i));
+        }
+        back.pathOffsets.push_back(static_cast<uint32_t>(back.pathPoints.size()));
+        back.shots.clear();
+        for (size_t k = 0; k < shots.size(); ++k) {
+            back.shots.push_back({ shots.pos(k), shots.velocity(k), shots.team[k] });
+        }
+
+        boost::lock_guard<boost::mutex> lock(snapshotMutex);
+        std::swap(back, latest);
+        latestFresh = true;
+    }
+
+    void run() {
+        using clock = std::chrono::steady_clock;
+        auto tickDuration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(simTickSeconds));
+        auto nextTick = clock::now();
+        profileThreadName("sim");
+
+        while (running.load()) {
+            int ticks = 0;
+            while (clock::now() >= nextTick && ticks < simMaxCatchUpTicks) {
+                step();
+                nextTick += tickDuration;
+                ++ticks;
+            }
+            if (ticks == simMaxCatchUpTicks) {
+                nextTick = clock::now(); // too far behind, drop the backlog
+            }
+            std::this_thread::sleep_until(nextTick);
+        }
+    }
+
+public:
+    explicit Impl(const SimConfig& config) :
+        pathService(config.pathWorkers, config.inlinePaths || config.lockstep, !config.lockstep),
+        collisionPool(config.collisionThreads),
+        lockstep(config.lockstep) {
+        registry.attach(waffles);
+    }
+
+    ~Impl() {
+        stop();
+    }
+
+    Entity addWaffle(const sf::Vector2f& pos, uint8_t team) {
+        Entity e = registry.create();
+        registry.emplace<Health>(e, waffleMaxHealth);
+        registry.emplace<Combat>(e, nullEntity);
+        size_t i = waffles.add(e, pos, team);
+        grid.addToCell(waffles.gridX[i], waffles.gridY[i], i);
+        return e;
+    }
+
+    // The spatial grid is rebuilt from the store at the start of every collision pass, so the
+    // slot shuffle from swap-and-pop needs no fix-up there.
+    void removeWaffle(Entity e) {
+        registry.destroy(e);
+        gridStale = true;
+    }
+
+    bool isAlive(Entity e) const {
+        return registry.alive(e);
+    }
+
+    void setWall(int gx, int gy, bool wall) {
+        if (changeWallCell(gx, gy, wall) || lockstep) wallChanged(gx, gy, wall);
+    }
+
+    // false when the cell already was that way, a lockstep peer's included
+    bool changeWallCell(int gx, int gy, bool wall) {
+        syncWallCache();
+        if (isWall(gx, gy) == wall) return false;
+        setWallCell(gx, gy, wall);
+        syncWallCache();
+        return true;
+    }
+
+    // After one cell of the map changed. Paths that now step through or diagonally past a new wall
+    // are queued for repair, every planner hears about the edit, and group orders on a flow field
+    // whose window covers the cell fall back to paths of their own. The map is shared by the
+    // process, so a lockstep peer re-routes its waffles even when another peer in it already made
+    // the edit on the same tick (wallOrderSystem).
+    void wallChanged(int gx, int gy, bool wall) {
+        lastFlowField.reset();
+        registry.view<PathRepair>([&](Entity, PathRepair& repair) { repair.planner.wallChanged(gx, gy); });
+
+        registry.view<FlowFieldFollower>([&](Entity e, FlowFieldFollower& follower) {
+            if (!follower.field->contains(gx, gy)) return;
+            size_t i = waffles.slotOf(e);
+            waffles.setTarget(i, waffles.pos(i));
+            waffles.pathPending[i] = 1;
+            pathService.requestPath(e, ++waffles.pathSerial[i], waffles.pos(i), waffles.orderGoal[i]);
+            registry.remove<FlowFieldFollower>(e);
+        });
+
+        // only a new wall can cut a path, a removed one at worst leaves it longer than needed
+        if (!wall) return;
+        auto cellOf = [](sf::Vector2f p) {
+            return std::pair<int, int>(static_cast<int>(std::floor(p.x / gridSize)), static_cast<int>(std::floor(p.y / gridSize)));
+        };
+        auto near = [&](std::pair<int, int> c) { return std::abs(c.first - gx) <= 1 && std::abs(c.second - gy) <= 1; };
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            const sf::Vector2f* path = waffles.pathData(i);
+            for (size_t k = 0; k < waffles.pathLength(i); ++k) {
+                std::pair<int, int> b = cellOf(path[k]);
+                std::pair<int, int> a = k > 0 ? cellOf(path[k - 1]) : b;
+                if ((near(a) || near(b)) && (isWall(b.first, b.second) || (a != b && !stepOpen(a.first, a.second, b.first, b.second)))) {
+                    needsRepair.push_back(waffles.entityAt(i));
+                    break;
+                }
+            }
+        }
+    }
+
+    // Section by section in SaveSection order, each padded to a 16-byte boundary. Columns the
+    // store already keeps packed are written straight from it.
+    bool save(const std::string& path) {
+        wallOrderSystem(); // the next tick would have, and the save has no place for them
+        const size_t n = waffles.size();
+        auto& health = registry.pool<Health>();
+        auto& combat = registry.pool<Combat>();
+
+        std::vector<uint8_t> flags(n);
+        std::vector<float> hp(n), cooldown(n);
+        std::vector<uint32_t> targets(n), pathOffsets(n + 1);
+        std::vector<sf::Vector2f> pathPoints;
+        for (size_t i = 0; i < n; ++i) {
+            Entity e = waffles.entityAt(i);
+            bool enRoute = waffles.pathPending[i] || registry.has<FlowFieldFollower>(e);
+            flags[i] = enRoute ? saveEnRoute : 0;
+            hp[i] = health.get(e).hp;
+            const Combat& c = combat.get(e);
+            cooldown[i] = c.cooldown;
+            targets[i] = waffles.has(c.target) ? static_cast<uint32_t>(waffles.slotOf(c.target)) : UINT32_MAX;
+            pathOffsets[i] = static_cast<uint32_t>(pathPoints.size());
+            pathPoints.insert(pathPoints.end(), waffles.pathData(i), waffles.pathData(i) + waffles.pathLength(i));
+        }
+        pathOffsets[n] = static_cast<uint32_t>(pathPoints.size());
+        std::vector<SaveWallEdit> edits;
+        collectWallEdits(edits);
+        const size_t s = shots.size();
+
+        const std::array<std::pair<const void*, size_t>, saveSectionCount> sections{ {
+            { waffles.x.data(), n * sizeof(float) },
+            { waffles.y.data(), n * sizeof(float) },
+            { waffles.targetX.data(), n * sizeof(float) },
+            { waffles.targetY.data(), n * sizeof(float) },
+            { waffles.team.data(), n },
+            { flags.data(), n },
+            { hp.data(), n * sizeof(float) },
+            { cooldown.data(), n * sizeof(float) },
+            { targets.data(), n * sizeof(uint32_t) },
+            { waffles.orderGoal.data(), n * sizeof(sf::Vector2f) },
+            { pathOffsets.data(), (n + 1) * sizeof(uint32_t) },
+            { pathPoints.data(), pathPoints.size() * sizeof(sf::Vector2f) },
+            { shots.x.data(), s * sizeof(float) },
+            { shots.y.data(), s * sizeof(float) },
+            { shots.vx.data(), s * sizeof(float) },
+            { shots.vy.data(), s * sizeof(float) },
+            { shots.life.data(), s * sizeof(float) },
+            { shots.team.data(), s },
+            { edits.data(), edits.size() * sizeof(SaveWallEdit) },
+            { waffles.selected.data(), n },
+        } };
+
+        SaveHeader header{ { 'W', 'A', 'F', 'S' }, saveVersion, tick, static_cast<uint32_t>(n),
+            static_cast<uint32_t>(pathPoints.size()), static_cast<uint32_t>(s), static_cast<uint32_t>(edits.size()),
+            static_cast<uint32_t>(saveSectionCount), 0 };
+        std::array<SaveSectionRange, saveSectionCount> ranges;
+        uint64_t offset = sizeof(header) + sizeof(ranges);
+        for (size_t k = 0; k < saveSectionCount; ++k) {
+            offset = (offset + 15) & ~uint64_t(15);
+            ranges[k] = { offset, sections[k].second };
+            offset += sections[k].second;
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(ranges.data()), sizeof(ranges));
+        uint64_t written = sizeof(header) + sizeof(ranges);
+        const char padding[16] = {};
+        for (size_t k = 0; k < saveSectionCount; ++k) {
+            out.write(padding, static_cast<std::streamsize>(ranges[k].offset - written));
+            out.write(static_cast<const char*>(sections[k].first), static_cast<std::streamsize>(sections[k].second));
+            written = ranges[k].offset + ranges[k].bytes;
+        }
+        return static_cast<bool>(out);
+    }
+
+    // Everything goes: waffles, shots, pending orders and the runtime wall edits. Results still
+    // queued for the old waffles name destroyed entities or forgotten group orders and are skipped.
+    void load(const SaveView& view) {
+        std::vector<Entity> old(waffles.set.entities().begin(), waffles.set.entities().end());
+        for (Entity e : old) registry.destroy(e);
+        gridStale = true;
+        shots.clear();
+        groupOrders.clear();
+        needsRepair.clear();
+        killed.clear();
+        lastFlowField.reset();
+        pendingWalls.clear();
+
+        clearWallEdits();
+        const SaveWallEdit* edits = view.section<SaveWallEdit>(SaveSection::WallEdits);
+        for (uint32_t k = 0; k < view.wallEdits(); ++k) setWallCell(edits[k].gx, edits[k].gy, edits[k].wall != 0);
+        syncWallCache();
+        tick = view.tick();
+
+        const uint32_t n = view.waffles();
+        const float* x = view.section<float>(SaveSection::X);
+        const float* y = view.section<float>(SaveSection::Y);
+        const uint8_t* team = view.section<uint8_t>(SaveSection::Team);
+        for (uint32_t i = 0; i < n; ++i) addWaffle({ x[i], y[i] }, team[i]);
+
+        // the store was empty, so slot i is save index i and whole columns copy across
+        std::copy_n(view.section<float>(SaveSection::TargetX), n, waffles.targetX.begin());
+        std::copy_n(view.section<float>(SaveSection::TargetY), n, waffles.targetY.begin());
+        std::copy_n(view.section<sf::Vector2f>(SaveSection::OrderGoal), n, waffles.orderGoal.begin());
+
+        const uint8_t* flags = view.section<uint8_t>(SaveSection::Flags);
+        const uint8_t* selection = view.has(SaveSection::Selection) ? view.section<uint8_t>(SaveSection::Selection) : nullptr;
+        const float* hp = view.section<float>(SaveSection::Health);
+        const float* cooldown = view.section<float>(SaveSection::Cooldown);
+        const uint32_t* targets = view.section<uint32_t>(SaveSection::CombatTarget);
+        const uint32_t* pathOffsets = view.section<uint32_t>(SaveSection::PathOffsets);
+        const sf::Vector2f* pathPoints = view.section<sf::Vector2f>(SaveSection::PathPoints);
+        for (uint32_t i = 0; i < n; ++i) {
+            Entity e = waffles.entityAt(i);
+            waffles.selected[i] = selection ? selection[i] : (flags[i] & saveSelected) != 0;
+            registry.get<Health>(e).hp = hp[i];
+            Combat& combat = registry.get<Combat>(e);
+            combat.cooldown = cooldown[i];
+            combat.target = targets[i] < n ? waffles.entityAt(targets[i]) : nullEntity;
+
+            if (flags[i] & saveEnRoute) {
+                waffles.setTarget(i, waffles.pos(i));
+                waffles.pathPending[i] = 1;
+                pathService.requestPath(e, ++waffles.pathSerial[i], waffles.pos(i), waffles.orderGoal[i]);
+            }
+            else if (pathOffsets[i] != pathOffsets[i + 1]) {
+                waffles.setPath(i, pathPoints + pathOffsets[i], pathPoints + pathOffsets[i + 1]);
+            }
+        }
+
+        const float* shotX = view.section<float>(SaveSection::ShotX);
+        const float* shotY = view.section<float>(SaveSection::ShotY);
+        const float* shotVx = view.section<float>(SaveSection::ShotVx);
+        const float* shotVy = view.section<float>(SaveSection::ShotVy);
+        const float* shotLife = view.section<float>(SaveSection::ShotLife);
+        const uint8_t* shotTeam = view.section<uint8_t>(SaveSection::ShotTeam);
+        for (uint32_t k = 0; k < view.shots() && k < projectileCapacity; ++k) {
+            shots.fire({ shotX[k], shotY[k] }, { shotVx[k], shotVy[k] }, shotTeam[k]);
+            shots.life[k] = shotLife[k];
+        }
+    }
+
+    // the log's ticks are the ones commandSystem runs on, so a replay pushes each command just
+    // before stepping that tick
+    void recordCommands(CommandLog* log) {
+        if (recording) recording->end(tick);
+        recording = log;
+        if (recording) recording->begin(tick);
+    }
+
+    void start() {
+        snapshotSystem();
+        running = true;
+        thread = boost::thread([this] { run(); });
+    }
+
+    void stop() {
+        running = false;
+        if (thread.joinable()) thread.join();
+    }
+
+    void pushCommand(const SimCommand& cmd) {
+        commands.push(cmd);
+    }
+
+    void step() {
+        PROFILE_ZONE("sim tick");
+        syncWallCache();
+        wallOrderSystem();
+        commandSystem();
+        pathResultSystem();
+        flowFieldSystem();
+        lodSystem();
+        movementSystem(simTickSeconds);
+        collisionSystem();
+        pathRepairSystem();
+        targetingSystem();
+        projectileSystem();
+
+        ++tick;
+        snapshotSystem();
+    }
+
+    bool takeSnapshot(WaffleSnapshot& out) {
+        boost::lock_guard<boost::mutex> lock(snapshotMutex);
+        if (!latestFresh) return false;
+        std::swap(out, latest);
+        latestFresh = false;
+        return true;
+    }
+
+    // FNV-1a over the bits of every position and health, in slot order
+    uint64_t checksum() {
+        auto& health = registry.pool<Health>();
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            hash = (hash ^ bits) * 1099511628211ull;
+        };
+        for (size_t i = 0; i < waffles.size(); ++i) {
+            mix(waffles.x[i]);
+            mix(waffles.y[i]);
+            mix(health.get(waffles.entityAt(i)).hp);
+        }
+        return hash;
+    }
+
+    void setView(const sf::FloatRect& area) {
+        boost::lock_guard<boost::mutex> lock(viewMutex);
+        view = area;
+    }
+
+    SimStats stats() const {
+        return { tick, waffles.size(), pathsApplied, flowFieldsApplied, pathRepairs, shots.size(), hits, kills, shots.dropped,
+            coarseWaffles };
+    }
+};
+
+Simulation::Simulation(const SimConfig& config) : impl(std::make_unique<Impl>(config)) {}
+
+Simulation::~Simulation() = default;
+
+Entity Simulation::addWaffle(const sf::Vector2f& pos, uint8_t team) {
+    return impl->addWaffle(pos, team);
+}
+
+void Simulation::removeWaffle(Entity waffle) {
+    impl->removeWaffle(waffle);
+}
+
+bool Simulation::isAlive(Entity waffle) const {
+    return impl->isAlive(waffle);
+}
+
+void Simulation::setWall(int gx, int gy, bool wall) {
+    impl->setWall(gx, gy, wall);
+}
+
+void Simulation::start() {
+    impl->start();
+}
+
+void Simulation::stop() {
+    impl->stop();
+}
+
+void Simulation::pushCommand(const SimCommand& cmd) {
+    impl->pushCommand(cmd);
+}
+
+void Simulation::step() {
+    impl->step();
+}
+
+bool Simulation::takeSnapshot(WaffleSnapshot& out) {
+    return impl->takeSnapshot(out);
+}
+
+void Simulation::setView(const sf::FloatRect& view) {
+    impl->setView(view);
+}
+
+SimStats Simulation::stats() const {
+    return impl->stats();
+}
+
+uint64_t Simulation::checksum() const {
+    return impl->checksum();
+}
+
+bool Simulation::save(const std::string& path) const {
+    return impl->save(path);
+}
+
+void Simulation::load(const SaveView& save) {
+    impl->load(save);
+}
+
+void Simulation::recordCommands(CommandLog* log) {
+    impl->recordCommands(log);
+}
+/* --------------------------------------------------------------------------------------------------- */
@@ -0,0 +1,359 @@
+﻿#pragma once
+
+#include "include.h"
+#include "Ecs.h"
+
+// The simulation library: waffles, movement, collisions, pathfinding and projectiles, with no
+// window or input.
+// RTStest renders it, headless and simbench drive it from scripted scenarios.
+
+const float speed = 1000.f;
+const float selectionRadius = 55.f;
+const float clickDragLimit = 5.f; // a selection drag shorter than this along both axes is a click
+const float collisionRadius = 47.f;
+const float gridSize = 200.f;
+
+// procedural map, only called to fill WallBitmap chunks
+inline bool wallHash(int gx, int gy) {
+    long long n = (long long)gx * 374761393 + (long long)gy * 668265263;
+    n = (n ^ (n >> 13)) * 1274126177;
+
+    // 1% chance of block appearing
+    return ((n ^ (n >> 16)) & 100) < 1;
+}
+
+// Walls built or cleared at runtime, layered over wallHash. Every edit bumps wallEpoch, and a
+// thread's cached chunks are dropped by syncWallCache() once it falls behind, so threads call that
+// before a batch of map reads (a path search, a collision pass, a frame).
+inline std::atomic<uint32_t> wallEpoch{ 0 };
+
+// map only, Simulation::setWall also re-routes the waffles it affects
+void setWallCell(int gx, int gy, bool wall);
+void clearWallEdits();
+
+// Cells edited after wallEpoch was `since`, for caches of what the map looks like. False when that
+// is further back than the recent edits kept, or before a clearWallEdits, so anything may differ.
+bool wallCellsChangedSince(uint32_t since, std::vector<std::pair<int, int>>& cells);
+
+const int wallChunkShift = 6; // 64x64 cells per chunk, one uint64_t per row
+const int wallChunkCells = 1 << wallChunkShift;
+const size_t wallCacheChunks = 256; // 128 KiB of bits per thread
+
+// Wall bits cached per 64x64-cell chunk, filled from wallHash the first time a chunk is touched.
+// Rows and columns are both stored so scans along either axis test 64 cells per word.
+struct WallChunk {
+    uint64_t rows[wallChunkCells]; // bit x of rows[y] is cell (x, y) in the chunk
+    uint64_t cols[wallChunkCells]; // bit y of cols[x]
+};
+
+// Recently used chunks of the calling thread, direct-mapped by the low 3 bits of the chunk
+// coords. Plain data so the lookup compiles to a compare and a load.
+struct WallChunkSlot {
+    long long key;
+    const WallChunk* chunk;
+};
+
+constexpr std::array<WallChunkSlot, 64> emptyWallChunkSlots() {
+    std::array<WallChunkSlot, 64> slots{};
+    for (auto& slot : slots) slot = { LLONG_MIN, nullptr };
+    return slots;
+}
+
+inline thread_local std::array<WallChunkSlot, 64> wallChunkSlots = emptyWallChunkSlots();
+
+// overwrites the runtime edits inside chunk (cx, cy) onto its wallHash bits
+void applyWallEdits(int cx, int cy, WallChunk& chunk);
+
+inline long long wallChunkKey(int cx, int cy) {
+    return (static_cast<long long>(cx) << 32) | static_cast<uint32_t>(cy);
+}
+
+// Bounded LRU of chunks behind the slot table. Every thread that reads the map has its own
+// (see wallBitmap()), so lookups take no locks.
+class WallBitmap {
+private:
+    struct Entry {
+        WallChunk chunk;
+        std::list<long long>::iterator lruPos;
+    };
+
+    std::unordered_map<long long, Entry> chunks;
+    std::list<long long> lru; // most recently fetched first
+
+public:
+    const WallChunk& fetch(int cx, int cy) {
+        long long key = wallChunkKey(cx, cy);
+        auto it = chunks.find(key);
+        if (it == chunks.end()) {
+            if (chunks.size() >= wallCacheChunks) {
+                chunks.erase(lru.back());
+                lru.pop_back();
+                wallChunkSlots = emptyWallChunkSlots();
+            }
+            it = chunks.try_emplace(key).first;
+            lru.push_front(key);
+            it->second.lruPos = lru.begin();
+
+            WallChunk& chunk = it->second.chunk;
+            std::fill(std::begin(chunk.cols), std::end(chunk.cols), 0);
+            for (int y = 0; y < wallChunkCells; ++y) {
+                uint64_t bits = 0;
+                for (int x = 0; x < wallChunkCells; ++x) {
+                    if (wallHash(cx * wallChunkCells + x, cy * wallChunkCells + y)) {
+                        bits |= uint64_t(1) << x;
+                        chunk.cols[x] |= uint64_t(1) << y;
+                    }
+                }
+                chunk.rows[y] = bits;
+            }
+            applyWallEdits(cx, cy, chunk);
+        }
+        else {
+            lru.splice(lru.begin(), lru, it->second.lruPos);
+        }
+
+        wallChunkSlots[(cx & 7) | (cy & 7) << 3] = { key, &it->second.chunk };
+        return it->second.chunk;
+    }
+
+    void clear() {
+        chunks.clear();
+        lru.clear();
+        wallChunkSlots = emptyWallChunkSlots();
+    }
+};
+
+inline WallBitmap& wallBitmap() {
+    static thread_local WallBitmap bitmap;
+    return bitmap;
+}
+
+inline void syncWallCache() {
+    static thread_local uint32_t seen = 0;
+    uint32_t epoch = wallEpoch.load(std::memory_order_acquire);
+    if (epoch != seen) {
+        wallBitmap().clear();
+        seen = epoch;
+    }
+}
+
+inline const WallChunk& wallChunk(int cx, int cy) {
+    const WallChunkSlot& slot = wallChunkSlots[(cx & 7) | (cy & 7) << 3];
+    if (slot.key == wallChunkKey(cx, cy)) return *slot.chunk;
+    return wallBitmap().fetch(cx, cy);
+}
+
+inline bool isWall(int gx, int gy) {
+    const WallChunk& chunk = wallChunk(gx >> wallChunkShift, gy >> wallChunkShift);
+    return (chunk.rows[gy & (wallChunkCells - 1)] >> (gx & (wallChunkCells - 1))) & 1;
+}
+
+// 64 cells of row gy starting at gx, bit k is cell (gx + k, gy)
+inline uint64_t wallRow(int gx, int gy) {
+    int shift = gx & (wallChunkCells - 1);
+    int row = gy & (wallChunkCells - 1);
+    uint64_t bits = wallChunk(gx >> wallChunkShift, gy >> wallChunkShift).rows[row] >> shift;
+    if (shift != 0) bits |= wallChunk((gx >> wallChunkShift) + 1, gy >> wallChunkShift).rows[row] << (wallChunkCells - shift);
+    return bits;
+}
+
+// walls among the 3x3 cells around (gx, gy), bit (x + 1) * 3 + (y + 1) for offset (x, y)
+inline unsigned wallNeighborhood(int gx, int gy) {
+    unsigned above = static_cast<unsigned>(wallRow(gx - 1, gy - 1) & 7);
+    unsigned middle = static_cast<unsigned>(wallRow(gx - 1, gy) & 7);
+    unsigned below = static_cast<unsigned>(wallRow(gx - 1, gy + 1) & 7);
+    auto spread = [](unsigned bits) { return (bits & 1) | (bits & 2) << 2 | (bits & 4) << 4; };
+    return spread(above) | spread(middle) << 1 | spread(below) << 2;
+}
+
+/* astar helpers -------------------------------------------------------------------------------------- */
+static inline long long hashKey(int gx, int gy) {
+    return (static_cast<long long>(gx) << 32) ^ static_cast<unsigned long long>(gy);
+}
+
+static inline float heuristic(int ax, int ay, int bx, int by) {
+    // Euclidean
+    float dx = float(ax - bx);
+    float dy = float(ay - by);
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+static inline sf::Vector2f gridToWorldCoord(int gx, int gy) { // grid coords in 
+    // center of cell
+    return sf::Vector2f(gx * gridSize + gridSize * 0.5f, gy * gridSize + gridSize * 0.5f);
+}
+
+// diagonals allowed. Ordered so the opposite of neighborOffsets[k] is neighborOffsets[7 - k]
+static constexpr int neighborOffsets[8][2] = { {-1,-1}, {-1,0}, {-1,1}, {0,-1}, {0,1}, {1,-1}, {1,0}, {1,1} };
+
+static inline int floorDiv(int a, int b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+/* --------------------------------------------------------------------------------------------------- */
+
+struct PathCacheStats {
+    uint64_t hits = 0;        // exact (start cell, goal cell) matches
+    uint64_t subPathHits = 0; // served from a cached path that passes through the start cell
+    uint64_t misses = 0;
+    uint64_t evictions = 0;   // dropped for capacity
+    uint64_t invalidations = 0;
+};
+
+// counters of the path cache shared by every Simulation in the process
+PathCacheStats pathCacheStats();
+void clearPathCache();
+
+// Self checks for `headless check`: random searches over a scrambled patch of walls, each answer
+// held to a plain A* that expands every neighbour. They edit the process-wide walls and clear
+// every edit when done, so run them before creating a Simulation.
+struct PathCheckStats {
+    uint64_t checks = 0;
+    uint64_t mismatches = 0; // the first few are printed to stderr
+};
+
+// JumpPoint searches must find a path exactly when A* does, at the same cost
+PathCheckStats checkJumpPointSearch(uint32_t seed, uint32_t queries);
+
+// A path repair planner re-planned after walls toggle next to its path and its waffle steps aside,
+// ten times per trial, must match a fresh A* search every time
+PathCheckStats checkPathRepair(uint32_t seed, uint32_t trials);
+
+/* simulation ---------------------------------------------------------------------------------------- */
+const float simTickRate = 60.f;
+const float simTickSeconds = 1.f / simTickRate;
+const int simMaxCatchUpTicks = 5; // after a longer stall the simulation drops time instead of racing
+
+enum class SimCommandType : uint8_t {
+    Select, // box or click selection, a = drag start, b = drag end
+    Move,   // right-click move order for the selected waffles, a = click position
+    Fire,   // every selected waffle shoots once towards a
+    BuildWall, // wall on the cell holding a, from the start of the next tick
+    ClearWall, // no wall on the cell holding a, from the start of the next tick
+};
+
+const int simMaxPlayers = 8; // selection is a bit per player
+
+struct SimCommand { // trivially copyable so it can live in the lock-free queue
+    SimCommandType type;
+    bool additive; // Select: keep the current selection (shift held)
+    sf::Vector2f a;
+    sf::Vector2f b;
+    uint8_t player = 0; // whose selection Select, Move and Fire use
+};
+
+// Render-side copy of the waffle state after one tick
+struct WaffleSnapshot {
+    uint64_t tick = 0;
+    std::chrono::steady_clock::time_point time;
+    std::vector<Entity> entities; // waffle i of this snapshot, slots shift when waffles are removed
+    std::vector<sf::Vector2f> positions;
+    std::vector<uint8_t> selected; // bit p set while player p has the waffle selected
+    std::vector<uint8_t> teams;
+    std::vector<sf::Vector2f> pathPoints;  // every waffle's path back to back
+    std::vector<uint32_t> pathOffsets;     // waffle i's path is [pathOffsets[i], pathOffsets[i + 1])
+
+    struct Shot {
+        sf::Vector2f pos;
+        sf::Vector2f velocity;
+        uint8_t team;
+    };
+    std::vector<Shot> shots;
+};
+
+// The waffles a selection drag would pick in one snapshot, for feedback drawn every frame (the
+// drag box preview, the waffle under the cursor) without scanning the whole army. Same rules as
+// SimCommandType::Select, over a cell index built by rebuild() once per new snapshot. Indices are
+// into that snapshot.
+class SnapshotPicker {
+public:
+    SnapshotPicker();
+    ~SnapshotPicker();
+
+    void rebuild(const WaffleSnapshot& snapshot);
+    void pick(sf::Vector2f dragStart, sf::Vector2f dragEnd, std::vector<size_t>& out) const;
+
+private:
+    struct Index;
+    std::unique_ptr<Index> index;
+};
+
+struct SimConfig {
+    unsigned pathWorkers = 0;      // 0 = one per core, less one for the main loop
+    unsigned collisionThreads = 0; // 0 = one per core
+    bool inlinePaths = false;      // run path jobs inside step() instead of on the workers, so a
+                                   // scripted run gives the same result every time
+    bool lockstep = false;         // a peer of a lockstep match (Lockstep.h): inline paths that skip
+                                   // the process-wide path cache, so every peer computes the same
+                                   // ticks whatever else its process has searched
+};
+
+struct SimStats {
+    uint64_t tick = 0;
+    size_t waffles = 0;
+    uint64_t paths = 0;      // path results applied, found or not
+    uint64_t flowFields = 0; // group flow fields applied
+    uint64_t pathRepairs = 0; // paths patched in place after a wall change or a shove
+    size_t shots = 0;        // projectiles in flight
+    uint64_t hits = 0;
+    uint64_t kills = 0;
+    uint64_t shotsDropped = 0; // fired while the projectile pool was full
+    size_t coarseWaffles = 0;  // simulated at reduced detail on the last tick, see setView
+};
+
+class SaveView;
+class CommandLog;
+
+// Owns the waffles and advances them at a fixed simTickRate on its own thread. Input reaches it
+// as SimCommands through a lock-free queue. After every tick it publishes a WaffleSnapshot; the
+// renderer keeps the two newest and interpolates between them, so frame rate and tick rate are
+// independent and a slow frame no longer slows the game down.
+class Simulation {
+public:
+    explicit Simulation(const SimConfig& config = {});
+    ~Simulation();
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    // only before start(), or between step() calls when no thread was started
+    Entity addWaffle(const sf::Vector2f& pos, uint8_t team = 0);
+    void removeWaffle(Entity waffle); // no-op for a handle that is already gone
+    bool isAlive(Entity waffle) const;
+    void setWall(int gx, int gy, bool wall); // same rules as addWaffle, BuildWall/ClearWall otherwise
+
+    void start();
+    void stop();
+
+    // safe from any thread
+    void pushCommand(const SimCommand& cmd);
+
+    // The world rectangle on screen, safe from any thread. Once set, waffles well outside it and
+    // away from any fight move at reduced detail until they come back into view or near an enemy.
+    // Ignored by lockstep peers, whose views differ; a scripted run with a view ends in a different
+    // state from one without.
+    void setView(const sf::FloatRect& view);
+
+    // One fixed tick. Called by the sim thread, or directly when no thread was started.
+    void step();
+
+    // Swaps the newest published snapshot into out if there is one the caller hasn't seen.
+    bool takeSnapshot(WaffleSnapshot& out);
+
+    // from the thread calling step(), or while the sim thread is stopped
+    SimStats stats() const;
+    uint64_t checksum() const; // of the waffle positions and health, compared by lockstep peers
+
+    // Captures (Replay.h), same rules as addWaffle. save() writes the waffles, shots and wall
+    // edits to a .wsave file. load() replaces all of them with the save's and sets the tick;
+    // waffles that were waiting on a path or following a flow field ask for a path again.
+    // recordCommands() appends every command run from the next tick on to log until it is called
+    // with null. Commands reach the log, direct calls such as setWall don't.
+    bool save(const std::string& path) const;
+    void load(const SaveView& save);
+    void recordCommands(CommandLog* log);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl;
+};
+/* --------------------------------------------------------------------------------------------------- */
@@ -0,0 +1,155 @@
+#include "Scenario.h"
+
+// Benchmark suite over the scripted scenarios, printed in the layout Google Benchmark uses so runs
+// can be diffed. Every case spawns its waffles, then times the whole scripted run:
+//   Time / CPU   wall and process CPU time per tick
+//   allocs/tick  heap allocations per tick, counted by the operator new below
+//   paths/s      path results applied per second of run time
+// Paths run inline, so each case does the same work on every run. --replay=<base> times a capture
+// (<base>.wsave and <base>.wlog, see Replay.h) instead of the scripted suite.
+//
+// usage: simbench [--benchmark_filter=<substring>] [--ticks=<n>] [--replay=<base>]
+
+static std::atomic<uint64_t> allocationCount{ 0 };
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+struct BenchCase {
+    std::string scenario;
+    size_t waffles;
+    uint64_t ticks;   // 0 runs a capture for as long as it was recorded
+    std::string capture;
+
+    std::string name() const {
+        if (!capture.empty()) return "BM_Replay/" + capture;
+        std::string title = scenario;
+        title[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(title[0])));
+        return "BM_" + title + "/" + std::to_string(waffles);
+    }
+};
+
+struct BenchResult {
+    double nsPerTick;
+    double cpuNsPerTick;
+    uint64_t ticks;
+    double allocsPerTick;
+    double pathsPerSecond;
+};
+
+static bool runCase(const BenchCase& bench, BenchResult& result) {
+    clearWallEdits(); // walls built by the previous case
+    SimConfig config;
+    config.inlinePaths = true;
+    Simulation sim(config);
+
+    Scenario scenario;
+    if (!bench.capture.empty()) {
+        if (!loadCapture(sim, bench.capture, scenario)) return false;
+        if (bench.ticks != 0) scenario.ticks = bench.ticks;
+    }
+    else {
+        makeScenario(bench.scenario, bench.waffles, 1, bench.ticks, scenario);
+        spawnScenario(sim, scenario);
+    }
+    clearPathCache();
+
+    size_t nextOrder = 0;
+    uint64_t allocsBefore = allocationCount.load();
+    std::clock_t cpuBegin = std::clock();
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t tick = 0; tick < scenario.ticks; ++tick) {
+        pushScenarioOrders(sim, scenario, tick, nextOrder);
+        sim.step();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double cpuSeconds = static_cast<double>(std::clock() - cpuBegin) / CLOCKS_PER_SEC;
+    uint64_t allocs = allocationCount.load() - allocsBefore;
+
+    SimStats stats = sim.stats();
+    double ticks = static_cast<double>(std::max<uint64_t>(scenario.ticks, 1));
+    result = { seconds * 1e9 / ticks, cpuSeconds * 1e9 / ticks, scenario.ticks,
+        static_cast<double>(allocs) / ticks, static_cast<double>(stats.paths) / seconds };
+    return true;
+}
+
+static std::string humanize(double value) {
+    const char* suffix[] = { "", "k", "M", "G" };
+    int unit = 0;
+    while (value >= 1000.0 && unit < 3) {
+        value /= 1000.0;
+        ++unit;
+    }
+    std::ostringstream out;
+    out << std::setprecision(value < 10.0 ? 3 : 4) << value << suffix[unit];
+    return out.str();
+}
+
+int main(int argc, char** argv)
+{
+    std::string filter;
+    uint64_t ticksOverride = 0;
+    std::string capture;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--benchmark_filter=", 0) == 0) filter = arg.substr(19);
+        else if (arg.rfind("--ticks=", 0) == 0) ticksOverride = std::stoull(arg.substr(8));
+        else if (arg.rfind("--replay=", 0) == 0) capture = arg.substr(9);
+        else {
+            std::cerr << "usage: simbench [--benchmark_filter=<substring>] [--ticks=<n>] [--replay=<base>]\n";
+            return 1;
+        }
+    }
+
+    std::vector<BenchCase> cases;
+    if (!capture.empty()) {
+        cases.push_back({ "replay", 0, ticksOverride, capture });
+    }
+    else {
+        for (const char* scenario : { "march", "scatter", "volley", "detour" }) {
+            for (size_t waffles : { 100, 1000, 10000, 100000 }) {
+                // fewer ticks for the big crowds so the suite stays in minutes
+                uint64_t ticks = waffles >= 100000 ? 60 : waffles >= 10000 ? 180 : 600;
+                cases.push_back({ scenario, waffles, ticksOverride ? ticksOverride : ticks, "" });
+            }
+        }
+    }
+
+    std::cout << "Run on (" << boost::thread::hardware_concurrency() << " X threads)\n";
+    const std::string rule(96, '-');
+    std::cout << rule << "\n"
+        << std::left << std::setw(28) << "Benchmark" << std::right
+        << std::setw(16) << "Time" << std::setw(16) << "CPU" << std::setw(12) << "Iterations"
+        << " UserCounters...\n"
+        << rule << "\n";
+
+    for (const BenchCase& bench : cases) {
+        std::string name = bench.name();
+        if (!filter.empty() && name.find(filter) == std::string::npos) continue;
+
+        BenchResult result{};
+        if (!runCase(bench, result)) {
+            std::cerr << "could not load the capture '" << bench.capture << "' (.wsave and .wlog)\n";
+            return 1;
+        }
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(0)
+            << std::setw(13) << result.nsPerTick << " ns"
+            << std::setw(13) << result.cpuNsPerTick << " ns"
+            << std::setw(12) << result.ticks
+            << " allocs/tick=" << humanize(result.allocsPerTick)
+            << " paths/s=" << humanize(result.pathsPerSecond) << "\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+    return 0;
+}
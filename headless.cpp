@@ -0,0 +1,279 @@
+#include "Scenario.h"
+#include "Profiler.h"
+#include "Lockstep.h"
+
+// Runs a scripted scenario without a window and prints what it cost and where it ended up.
+// Paths run inline, so the same arguments always print the same checksum.
+//
+// --capture=<base> also writes the run as <base>.wsave and <base>.wlog, and replay runs such a
+// capture (or one taken with F5 in the game) again.
+//
+// --view=<x>,<y>,<w>,<h> runs with that world rectangle on screen, so waffles outside it drop to
+// the reduced level of detail (Simulation::setView) and the run costs what a game looking there
+// would.
+//
+// --lockstep[=players] plays the scenario as a lockstep match instead: one Simulation per player
+// over a loopback network with --latency=<ms> one way and --loss=<percent> of datagrams dropped.
+// Each selection and the orders after it go to the next player in turn, and every peer should
+// print the same checksum.
+//
+// check runs the path search self checks (checkJumpPointSearch, checkPathRepair) and a barricade
+// run at several collision thread counts instead of a scenario, and fails on any mismatch.
+//
+// usage: headless [march|scatter|volley|detour|barricade] [waffles] [seed] [ticks] [trace.json] [--capture=<base>] [--view=<x>,<y>,<w>,<h>]
+//        headless [march|scatter|volley|detour|barricade] [waffles] [seed] [ticks] --lockstep[=players] [--latency=<ms>] [--loss=<percent>]
+//        headless replay <base> [ticks] [trace.json]
+//        headless check [seed] [queries]
+
+// The wall grid and the path caches are shared by every Simulation in the process. A peer makes
+// the wall orders of a tick at the start of its next one, and only steps while no other peer is
+// behind it, so by then every peer has finished the tick without the new walls, the way separate
+// machines would. barricade builds walls on the same tick as its moves.
+static int runLockstep(const Scenario& scenario, size_t players, const LoopbackConfig& network)
+{
+    SimConfig config;
+    config.lockstep = true;
+    LoopbackNetwork loopback(players, network);
+    std::vector<std::unique_ptr<Simulation>> sims;
+    std::vector<std::unique_ptr<LockstepSession>> sessions;
+    for (size_t p = 0; p < players; ++p) {
+        sims.push_back(std::make_unique<Simulation>(config));
+        spawnScenario(*sims.back(), scenario);
+        LockstepConfig session;
+        session.player = static_cast<uint8_t>(p);
+        session.players = static_cast<uint8_t>(players);
+        sessions.push_back(std::make_unique<LockstepSession>(*sims.back(), loopback.endpoint(p), session));
+    }
+    clearPathCache();
+
+    // a Select starts a group, the group and the orders after it belong to one player
+    std::vector<size_t> owner(scenario.orders.size());
+    size_t group = 0;
+    for (size_t k = 0; k < scenario.orders.size(); ++k) {
+        if (scenario.orders[k].command.type == SimCommandType::Select && k > 0) ++group;
+        owner[k] = group % players;
+    }
+
+    std::vector<size_t> nextOrder(players, 0);
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t frames = 0;
+    // a match that can't finish (every datagram lost) gives up instead of spinning
+    uint64_t frameLimit = (scenario.ticks + 60) * 100;
+    for (; frames < frameLimit; ++frames) {
+        uint64_t slowest = UINT64_MAX;
+        for (const auto& session : sessions) slowest = std::min(slowest, session->currentTick());
+        if (slowest >= scenario.ticks) break;
+
+        loopback.advance(simTickSeconds);
+        for (size_t p = 0; p < players; ++p) {
+            LockstepSession& session = *sessions[p];
+            session.poll();
+            if (session.currentTick() != slowest) {
+                session.send();
+                continue;
+            }
+            size_t& next = nextOrder[p];
+            while (next < scenario.orders.size() && scenario.orders[next].tick <= session.currentTick()) {
+                if (owner[next] == p) session.pushCommand(scenario.orders[next].command);
+                ++next;
+            }
+            session.step();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << scenario.name << ": " << players << " players, " << sims[0]->stats().waffles << " waffles, seed "
+        << scenario.seed << ", " << scenario.ticks << " ticks in " << frames << " frames, " << seconds * 1e3 << " ms\n";
+    std::cout << "network: " << network.latency * 1e3 << " ms, " << network.loss * 100.0 << "% loss, "
+        << loopback.sent << " datagrams, " << loopback.dropped << " dropped\n";
+    bool agree = true;
+    WaffleSnapshot snapshot;
+    uint64_t first = 0;
+    for (size_t p = 0; p < players; ++p) {
+        const LockstepSession& session = *sessions[p];
+        const LockstepStats& stats = session.stats();
+        sims[p]->takeSnapshot(snapshot);
+        uint64_t checksum = snapshotChecksum(snapshot);
+        if (p == 0) first = checksum;
+        agree = agree && checksum == first && !session.desynced() && session.currentTick() >= scenario.ticks;
+        std::cout << "player " << p << ": tick " << session.currentTick() << ", stalls " << stats.stalls
+            << ", packets " << stats.packetsSent << " sent " << stats.packetsReceived << " received "
+            << stats.packetsRejected << " rejected, " << stats.checksumsCompared << " checksums compared, ";
+        if (session.desynced()) std::cout << "desync at tick " << session.desyncTick();
+        else std::cout << "in sync";
+        std::cout << ", checksum: " << std::hex << checksum << std::dec << "\n";
+    }
+    return agree ? 0 : 1;
+}
+
+// The collision passes promise the same result whatever the thread count, so a run with walls going
+// up next to the crowd must end on the same checksum with one collision thread as with several.
+static PathCheckStats checkCollisionThreads(uint32_t seed)
+{
+    Scenario scenario;
+    makeScenario("barricade", 2000, seed, 300, scenario);
+    PathCheckStats stats;
+    uint64_t reference = 0;
+    for (unsigned threads : { 1u, 2u, 4u, 8u }) {
+        clearWallEdits();
+        SimConfig config;
+        config.inlinePaths = true;
+        config.collisionThreads = threads;
+        Simulation sim(config);
+        spawnScenario(sim, scenario);
+        clearPathCache();
+        size_t nextOrder = 0;
+        for (uint64_t tick = 0; tick < scenario.ticks; ++tick) {
+            pushScenarioOrders(sim, scenario, tick, nextOrder);
+            sim.step();
+        }
+
+        uint64_t checksum = sim.checksum();
+        if (threads == 1) {
+            reference = checksum;
+            continue;
+        }
+        ++stats.checks;
+        if (checksum != reference) {
+            ++stats.mismatches;
+            std::cerr << "collision threads " << threads << ": checksum " << std::hex << checksum << ", 1 thread "
+                << reference << std::dec << "\n";
+        }
+    }
+    clearWallEdits();
+    return stats;
+}
+
+static int runChecks(uint32_t seed, uint32_t queries)
+{
+    PathCheckStats jumpPoint = checkJumpPointSearch(seed, queries);
+    std::cout << "jump point search: " << jumpPoint.checks << " queries, " << jumpPoint.mismatches << " mismatches\n";
+    PathCheckStats repair = checkPathRepair(seed, std::max<uint32_t>(queries / 10, 1));
+    std::cout << "path repair: " << repair.checks << " re-plans, " << repair.mismatches << " mismatches\n";
+    PathCheckStats collisions = checkCollisionThreads(seed);
+    std::cout << "collision threads: " << collisions.checks << " runs against 1 thread, " << collisions.mismatches << " mismatches\n";
+    return jumpPoint.mismatches == 0 && repair.mismatches == 0 && collisions.mismatches == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args;
+    std::string capturePath;
+    size_t lockstepPlayers = 0;
+    LoopbackConfig network;
+    std::optional<sf::FloatRect> view;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--capture=", 0) == 0) capturePath = arg.substr(10);
+        else if (arg == "--lockstep") lockstepPlayers = 2;
+        else if (arg.rfind("--lockstep=", 0) == 0) lockstepPlayers = std::stoul(arg.substr(11));
+        else if (arg.rfind("--latency=", 0) == 0) network.latency = std::stod(arg.substr(10)) * 1e-3;
+        else if (arg.rfind("--loss=", 0) == 0) network.loss = std::stod(arg.substr(7)) * 1e-2;
+        else if (arg.rfind("--view=", 0) == 0) {
+            sf::FloatRect rect;
+            if (std::sscanf(arg.c_str() + 7, "%f,%f,%f,%f", &rect.position.x, &rect.position.y, &rect.size.x, &rect.size.y) != 4) {
+                std::cerr << "expected --view=<x>,<y>,<w>,<h>\n";
+                return 1;
+            }
+            view = rect;
+        }
+        else args.push_back(arg);
+    }
+    if (lockstepPlayers > static_cast<size_t>(simMaxPlayers)) {
+        std::cerr << "at most " << simMaxPlayers << " players\n";
+        return 1;
+    }
+    auto arg = [&](size_t k, const std::string& fallback) { return k < args.size() ? args[k] : fallback; };
+    profileThreadName("main");
+
+    if (arg(0, "") == "check") {
+        return runChecks(static_cast<uint32_t>(std::stoul(arg(1, "1"))), static_cast<uint32_t>(std::stoul(arg(2, "400"))));
+    }
+
+    SimConfig config;
+    config.inlinePaths = true;
+    Simulation sim(config);
+
+    std::string name = arg(0, "march");
+    Scenario scenario;
+    std::string tracePath;
+    if (name == "replay") {
+        if (lockstepPlayers > 0) {
+            std::cerr << "replay can't be played as a lockstep match\n";
+            return 1;
+        }
+        if (!loadCapture(sim, arg(1, ""), scenario)) {
+            std::cerr << "could not load the capture '" << arg(1, "") << "' (.wsave and .wlog)\n";
+            return 1;
+        }
+        if (args.size() > 2) scenario.ticks = std::stoull(args[2]);
+        tracePath = arg(3, "");
+    }
+    else {
+        size_t waffles = std::stoul(arg(1, "1000"));
+        uint32_t seed = static_cast<uint32_t>(std::stoul(arg(2, "1")));
+        uint64_t ticks = std::stoull(arg(3, "600"));
+        tracePath = arg(4, "");
+        if (!makeScenario(name, waffles, seed, ticks, scenario)) {
+            std::cerr << "unknown scenario '" << name << "', expected march, scatter, volley, detour, barricade, replay or check\n";
+            return 1;
+        }
+        if (lockstepPlayers > 0) {
+            if (lockstepPlayers < 2) {
+                std::cerr << "a lockstep match needs at least 2 players\n";
+                return 1;
+            }
+            return runLockstep(scenario, lockstepPlayers, network);
+        }
+        spawnScenario(sim, scenario);
+    }
+    clearPathCache();
+    if (view) sim.setView(*view);
+
+    CommandLog log;
+    if (!capturePath.empty()) {
+        if (!sim.save(capturePath + ".wsave")) {
+            std::cerr << "could not write " << capturePath << ".wsave\n";
+            return 1;
+        }
+        sim.recordCommands(&log);
+    }
+
+    WaffleSnapshot snapshot;
+    size_t nextOrder = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t tick = 0; tick < scenario.ticks; ++tick) {
+        pushScenarioOrders(sim, scenario, tick, nextOrder);
+        sim.step();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    sim.takeSnapshot(snapshot);
+
+    if (!capturePath.empty()) {
+        sim.recordCommands(nullptr);
+        if (!log.write(capturePath + ".wlog")) {
+            std::cerr << "could not write " << capturePath << ".wlog\n";
+            return 1;
+        }
+    }
+
+    SimStats stats = sim.stats();
+    std::cout << scenario.name << ": " << stats.waffles << " waffles, seed " << scenario.seed << ", "
+        << scenario.ticks << " ticks in " << seconds * 1e3 << " ms ("
+        << seconds * 1e9 / static_cast<double>(std::max<uint64_t>(scenario.ticks, 1)) << " ns/tick)\n";
+    std::cout << "paths: " << stats.paths << ", flow fields: " << stats.flowFields << ", repairs: " << stats.pathRepairs << "\n";
+    if (view) std::cout << "level of detail: " << stats.coarseWaffles << " coarse waffles on the last tick\n";
+    std::cout << "shots in flight: " << stats.shots << ", hits: " << stats.hits << ", kills: " << stats.kills
+        << ", dropped: " << stats.shotsDropped << "\n";
+    std::cout << "checksum: " << std::hex << snapshotChecksum(snapshot) << std::dec << "\n";
+
+    // the rings keep the newest events, so a long run traces its last ticks
+    if (!tracePath.empty()) {
+        if (!exportChromeTrace(tracePath)) {
+            std::cerr << "could not write " << tracePath << "\n";
+            return 1;
+        }
+        std::cout << "trace: " << tracePath << "\n";
+    }
+    return 0;
+}
@@ -14,6 +14,32 @@
 #include <utility>
 #include <climits>
 #include <deque>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <chrono>
+#include <thread>
+#include <bit>
+#include <array>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <string_view>
+#include <tuple>
+#include <map>
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WAFFLE_SIMD_SSE2 1
+#else
+#define WAFFLE_SIMD_SSE2 0
+#endif
 
 #include <boost/thread.hpp>
 #include <boost/lockfree/queue.hpp>
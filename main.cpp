@@ -1,357 +1,442 @@
-﻿#include "include.h"
-
-const float speed = 1000.f;
-const float selectionRadius = 55.f;
-const float collisionRadius = 47.f;
-const float gridSize = 200.f;
-
-struct Waffle {
-    static size_t latestID;  // Shared across instances
-    size_t id;             // Unique
-
-    sf::Vector2f pos;
-    sf::Vector2f targetPos;
-    bool isSelected = false;
-    std::deque<sf::Vector2f> path; // world positions of path nodes 
-    int gridX = 0;
-    int gridY = 0;
-    Waffle(sf::Vector2f position) : 
-        pos(position), 
-        targetPos(position), 
-        id(latestID++) 
-    {
-        gridX = static_cast<int>(std::floor(pos.x / gridSize));
-        gridY = static_cast<int>(std::floor(pos.y / gridSize));
-    }
-};
-
-size_t Waffle::latestID = 0;
-
-inline bool isWall(int gx, int gy) {
-    long long n = (long long)gx * 374761393 + (long long)gy * 668265263;
-    n = (n ^ (n >> 13)) * 1274126177;
-
-    // 1% chance of block appearing
-    return ((n ^ (n >> 16)) & 100) < 1;
-}
-
-/* astar helpers -------------------------------------------------------------------------------------- */
-static inline long long hashKey(int gx, int gy) {
-    return (static_cast<long long>(gx) << 32) ^ static_cast<unsigned long long>(gy);
-} // also used in EntityGrid
-
-struct Node {
-    int gx, gy;
-    float g = 0.f;
-    float h = 0.f;
-    float f() const { return g + h; }
-    std::pair<int, int> parent = { INT_MIN, INT_MIN }; //coords of previous node
-};
-
-static inline float heuristic(int ax, int ay, int bx, int by) {
-    // Euclidean
-    float dx = float(ax - bx);
-    float dy = float(ay - by);
-    return std::sqrt(dx * dx + dy * dy);
-}
-
-static inline sf::Vector2f gridToWorldCoord(int gx, int gy) { // grid coords in 
-    // center of cell
-    return sf::Vector2f(gx * gridSize + gridSize * 0.5f, gy * gridSize + gridSize * 0.5f);
-}
+﻿#include "Simulation.h"
+#include "Profiler.h"
+#include "Replay.h"
+
+// Background grid baked into per-chunk vertex buffers. A chunk is built the first time the camera
+// sees it and kept in an LRU, so a frame costs one draw per visible chunk however far out the
+// camera is zoomed. Cell outlines are 2 screen pixels wide, so chunks are re-baked when the zoom
+// level they were built for changes, and the chunk holding a cell when a wall is built or cleared
+// there.
+const int terrainChunkCells = 16;
+const size_t terrainChunkCacheSize = 128;
+
+class TerrainChunkCache {
+private:
+    struct Chunk {
+        sf::VertexBuffer buffer{ sf::PrimitiveType::Triangles, sf::VertexBuffer::Usage::Static };
+        std::vector<sf::Vertex> vertices; // only kept when vertex buffers are unavailable
+        float outlineThickness = -1.f;
+        std::list<long long>::iterator lruPos;
+    };
 
-static inline std::vector<std::pair<int, int>> getNeighbors(int gx, int gy) {
-    // diagonals allowed
-    std::vector<std::pair<int, int>> n;
-    for (int dx = -1; dx <= 1; ++dx) {
-        for (int dy = -1; dy <= 1; ++dy) {
-            if (dx == 0 && dy == 0) continue;
-            n.emplace_back(gx + dx, gy + dy);
-        }
+    std::unordered_map<long long, Chunk> chunks;
+    std::list<long long> lru; // most recently drawn first
+    std::vector<sf::Vertex> scratch;
+    uint32_t bakedEpoch = 0; // wallEpoch the chunks were baked under
+    std::vector<std::pair<int, int>> changedCells;
+
+    static void appendRect(std::vector<sf::Vertex>& out, float x, float y, float w, float h, sf::Color color) {
+        sf::Vertex tl{ { x, y }, color };
+        sf::Vertex tr{ { x + w, y }, color };
+        sf::Vertex br{ { x + w, y + h }, color };
+        sf::Vertex bl{ { x, y + h }, color };
+        out.push_back(tl);
+        out.push_back(tr);
+        out.push_back(br);
+        out.push_back(tl);
+        out.push_back(br);
+        out.push_back(bl);
     }
-    return n;
-}
-/* --------------------------------------------------------------------------------------------------- */
-
-std::deque<sf::Vector2f> findPathAstar(const sf::Vector2f& startWorld, const sf::Vector2f& goalWorld) {
-    // Convert to grid coords
-    int startGx = static_cast<int>(std::floor(startWorld.x / gridSize));
-    int startGy = static_cast<int>(std::floor(startWorld.y / gridSize));
-    int goalGx = static_cast<int>(std::floor(goalWorld.x / gridSize));
-    int goalGy = static_cast<int>(std::floor(goalWorld.y / gridSize));
-
-    // If goal = wall, pick nearby non-wall (within radius 3)
-    if (isWall(goalGx, goalGy)) {
-        bool found = false;
-        for (int r = 1; r <= 3 && !found; ++r) {
-            for (int dx = -r; dx <= r && !found; ++dx) {
-                for (int dy = -r; dy <= r && !found; ++dy) {
-                    int gx = goalGx + dx;
-                    int gy = goalGy + dy;
-                    if (!isWall(gx, gy)) {
-                        goalGx = gx;
-                        goalGy = gy;
-                        found = true;
-                    }
+
+    void bake(Chunk& chunk, int cx, int cy, float thickness) {
+        scratch.clear();
+        const sf::Color outline(0, 150, 0);
+        for (int ly = 0; ly < terrainChunkCells; ++ly) {
+            for (int lx = 0; lx < terrainChunkCells; ++lx) {
+                int gx = cx * terrainChunkCells + lx;
+                int gy = cy * terrainChunkCells + ly;
+                float x = gx * gridSize;
+                float y = gy * gridSize;
+
+                if (isWall(gx, gy)) {
+                    appendRect(scratch, x, y, gridSize, gridSize, sf::Color::Black);
+                }
+                else {
+                    // outline drawn inside the cell, like a negative outline thickness
+                    appendRect(scratch, x, y, gridSize, thickness, outline);
+                    appendRect(scratch, x, y + gridSize - thickness, gridSize, thickness, outline);
+                    appendRect(scratch, x, y + thickness, thickness, gridSize - 2.f * thickness, outline);
+                    appendRect(scratch, x + gridSize - thickness, y + thickness, thickness, gridSize - 2.f * thickness, outline);
                 }
             }
         }
-        if (!found) {
-            return {};
+
+        chunk.outlineThickness = thickness;
+        if (sf::VertexBuffer::isAvailable() && chunk.buffer.create(scratch.size()) && chunk.buffer.update(scratch.data())) {
+            chunk.vertices.clear();
+        }
+        else {
+            chunk.vertices = scratch;
         }
     }
 
-    // Open set: priority queue keyed on f = g + h
-    struct PQItem {
-        int gx, gy;
-        float f;
-        float g;
-        bool operator<(PQItem const& o) const { return f > o.f; } // min-heap
-    };
-    std::priority_queue<PQItem> openPQ;
-
-    std::unordered_map<long long, Node> nodes;
-
-    Node startNode;
-    startNode.g = 0.f;
-    startNode.h = heuristic(startGx, startGy, goalGx, goalGy);
-    startNode.parent = { INT_MIN, INT_MIN };
-    nodes[hashKey(startGx, startGy)] = startNode;
-
-    openPQ.push({ startGx, startGy, startNode.f(), startNode.g });
-
-    std::unordered_set<long long> closed;
-
-    while (!openPQ.empty()) {
-        auto top = openPQ.top(); 
-        openPQ.pop();
-        int cx = top.gx;
-        int cy = top.gy;
-        long long ckey = hashKey(cx, cy);
-        if (closed.find(ckey) != closed.end()) continue;
-        closed.insert(ckey);
-
-        if (cx == goalGx && cy == goalGy) {
-            std::deque<sf::Vector2f> path;
-            std::pair<int, int> cur = { cx, cy };
-            while (!(cur.first == INT_MIN && cur.second == INT_MIN)) {
-                path.push_front(gridToWorldCoord(cur.first, cur.second));
-                long long curk = hashKey(cur.first, cur.second);
-                auto it = nodes.find(curk);
-                if (it == nodes.end()) break;
-                cur = it->second.parent;
+    Chunk& fetch(int cx, int cy, float thickness) {
+        long long key = hashKey(cx, cy);
+        auto it = chunks.find(key);
+        if (it == chunks.end()) {
+            while (chunks.size() >= terrainChunkCacheSize) {
+                chunks.erase(lru.back());
+                lru.pop_back();
             }
-            return path;
+            it = chunks.try_emplace(key).first;
+            lru.push_front(key);
+            it->second.lruPos = lru.begin();
+        }
+        else {
+            lru.splice(lru.begin(), lru, it->second.lruPos);
         }
 
-        // neighbors
-        for (auto nb : getNeighbors(cx, cy)) {
-            int ngx = nb.first;
-            int ngy = nb.second;
-            long long nbk = hashKey(ngx, ngy);
-
-            if (closed.find(nbk) != closed.end()) continue;
-
-            int dx = ngx - cx;
-            int dy = ngy - cy;
+        Chunk& chunk = it->second;
+        if (chunk.outlineThickness != thickness) bake(chunk, cx, cy, thickness);
+        return chunk;
+    }
 
-            // block diagonal corner cutting
-            if (dx != 0 && dy != 0) {
-                if (isWall(cx + dx, cy) || isWall(cx, cy + dy)) {
-                    continue;
+public:
+    // [startGx, endGx) x [startGy, endGy) is the visible cell range
+    void draw(sf::RenderTarget& target, int startGx, int endGx, int startGy, int endGy, float zoomLevel) {
+        float thickness = 2.f * zoomLevel;
+        syncWallCache();
+        uint32_t epoch = wallEpoch.load(std::memory_order_acquire);
+        if (epoch != bakedEpoch) {
+            if (wallCellsChangedSince(bakedEpoch, changedCells)) {
+                for (auto [gx, gy] : changedCells) {
+                    auto it = chunks.find(hashKey(floorDiv(gx, terrainChunkCells), floorDiv(gy, terrainChunkCells)));
+                    if (it == chunks.end()) continue;
+                    lru.erase(it->second.lruPos);
+                    chunks.erase(it);
                 }
             }
+            else {
+                chunks.clear();
+                lru.clear();
+            }
+            bakedEpoch = epoch;
+        }
 
-            if (isWall(ngx, ngy)) continue;
-
-            float moveCost = heuristic(cx, cy, ngx, ngy); // diagonal cost ~= 1.414, straight 1
-            float tentativeG = nodes[ckey].g + moveCost;
+        int startCx = floorDiv(startGx, terrainChunkCells);
+        int endCx = floorDiv(endGx - 1, terrainChunkCells);
+        int startCy = floorDiv(startGy, terrainChunkCells);
+        int endCy = floorDiv(endGy - 1, terrainChunkCells);
 
-            auto it = nodes.find(nbk);
-            if (it == nodes.end() || tentativeG < it->second.g) {
-                Node neighbor;
-                neighbor.g = tentativeG;
-                neighbor.h = heuristic(ngx, ngy, goalGx, goalGy);
-                neighbor.parent = { cx, cy };
-                nodes[nbk] = neighbor;
-                openPQ.push({ ngx, ngy, neighbor.f(), neighbor.g });
+        for (int cy = startCy; cy <= endCy; ++cy) {
+            for (int cx = startCx; cx <= endCx; ++cx) {
+                const Chunk& chunk = fetch(cx, cy, thickness);
+                if (chunk.vertices.empty()) {
+                    target.draw(chunk.buffer);
+                }
+                else {
+                    target.draw(chunk.vertices.data(), chunk.vertices.size(), sf::PrimitiveType::Triangles);
+                }
             }
         }
     }
-    // failed to find path
-    return {};
+};
+
+inline sf::Color teamTint(uint8_t team) {
+    static const sf::Color tints[] = { sf::Color::White, sf::Color(150, 190, 255), sf::Color(255, 160, 150), sf::Color(170, 255, 160) };
+    return tints[team % std::size(tints)];
 }
 
-class EntityGrid {
+// Draws every waffle in three calls: one line batch for all paths, one textured triangle batch
+// for the sprites and one for the selection rings. The vertex arrays persist between frames,
+// so after the first frames nothing is allocated either.
+class WaffleBatchRenderer {
 private:
-    std::unordered_map<long long, std::unordered_set<size_t>> wafflesInCell;
-    float cellSize;
+    static constexpr int ringSegments = 30; // CircleShape's default point count
+    static constexpr float spriteScale = 0.25f;
 
-public:
-    EntityGrid(float size) : cellSize(size) {}
+    const sf::Texture& texture;
+    sf::VertexArray sprites{ sf::PrimitiveType::Triangles };
+    sf::VertexArray rings{ sf::PrimitiveType::Triangles };
+    sf::VertexArray pathLines{ sf::PrimitiveType::Lines };
+    sf::Vector2f ringDirs[ringSegments];
+    std::vector<uint8_t> previewed; // per waffle of curr
 
-    void addToCell(int gx, int gy, size_t waffleId) {
-        wafflesInCell[hashKey(gx, gy)].insert(waffleId);
+public:
+    explicit WaffleBatchRenderer(const sf::Texture& tex) : texture(tex) {
+        for (int k = 0; k < ringSegments; ++k) {
+            float angle = 2.f * 3.14159265f * k / ringSegments;
+            ringDirs[k] = sf::Vector2f(std::cos(angle), std::sin(angle));
+        }
     }
 
-    void removeFromCell(int gx, int gy, size_t waffleId) {
-        auto key = hashKey(gx, gy);
-        auto it = wafflesInCell.find(key);
-        if (it != wafflesInCell.end()) {
-            it->second.erase(waffleId);
-            if (it->second.empty()) {
-                wafflesInCell.erase(it);
-            }
+    // Positions are interpolated from prev to curr by alpha where both snapshots hold the same
+    // waffle in that slot; paths and selection come from curr. preview holds indices into curr
+    // that the selection being dragged would pick, ringed fainter than the selected ones.
+    void build(const WaffleSnapshot& prev, const WaffleSnapshot& curr, float alpha, float zoomLevel,
+        const std::vector<size_t>& preview) {
+        sprites.clear();
+        rings.clear();
+        pathLines.clear();
+        previewed.assign(curr.positions.size(), 0);
+        for (size_t i : preview) {
+            if (i < previewed.size()) previewed[i] = 1;
         }
-    }
 
-    std::vector<size_t> queryNeighbors(int gx, int gy) const {
-        std::vector<size_t> result;
+        sf::Vector2f texSize(texture.getSize());
+        sf::Vector2f half = texSize * (spriteScale * 0.5f);
+        float ringInner = selectionRadius;
+        float ringOuter = selectionRadius + 5.f * zoomLevel;
+
+        for (size_t i = 0; i < curr.positions.size(); ++i) {
+            sf::Vector2f pos = curr.positions[i];
+            if (i < prev.positions.size() && prev.entities[i] == curr.entities[i]) {
+                pos = prev.positions[i] + (curr.positions[i] - prev.positions[i]) * alpha;
+            }
+
+            // A* path
+            for (uint32_t k = curr.pathOffsets[i]; k + 1 < curr.pathOffsets[i + 1]; ++k) {
+                pathLines.append({ curr.pathPoints[k], sf::Color::Red });
+                pathLines.append({ curr.pathPoints[k + 1], sf::Color::Red });
+            }
 
-        for (int dx = -1; dx <= 1; ++dx) {
-            for (int dy = -1; dy <= 1; ++dy) {
-                auto it = wafflesInCell.find(hashKey(gx + dx, gy + dy));
-                if (it != wafflesInCell.end()) {
-                    result.insert(result.end(),
-                        it->second.begin(),
-                        it->second.end());
+            // sprite quad, two triangles, tinted by team
+            sf::Color tint = teamTint(curr.teams[i]);
+            sf::Vertex tl{ pos + sf::Vector2f(-half.x, -half.y), tint, { 0.f, 0.f } };
+            sf::Vertex tr{ pos + sf::Vector2f(half.x, -half.y), tint, { texSize.x, 0.f } };
+            sf::Vertex br{ pos + sf::Vector2f(half.x, half.y), tint, { texSize.x, texSize.y } };
+            sf::Vertex bl{ pos + sf::Vector2f(-half.x, half.y), tint, { 0.f, texSize.y } };
+            sprites.append(tl);
+            sprites.append(tr);
+            sprites.append(br);
+            sprites.append(tl);
+            sprites.append(br);
+            sprites.append(bl);
+
+            if (curr.selected[i] || previewed[i]) {
+                sf::Color color = curr.selected[i] ? sf::Color::Blue : sf::Color(100, 100, 255, 160);
+                for (int k = 0; k < ringSegments; ++k) {
+                    const sf::Vector2f& a = ringDirs[k];
+                    const sf::Vector2f& b = ringDirs[(k + 1) % ringSegments];
+                    sf::Vertex ai{ pos + a * ringInner, color };
+                    sf::Vertex ao{ pos + a * ringOuter, color };
+                    sf::Vertex bi{ pos + b * ringInner, color };
+                    sf::Vertex bo{ pos + b * ringOuter, color };
+                    rings.append(ai);
+                    rings.append(ao);
+                    rings.append(bo);
+                    rings.append(ai);
+                    rings.append(bo);
+                    rings.append(bi);
                 }
             }
         }
-        return result;
     }
 
-    void clear() {
-        wafflesInCell.clear();
+    void draw(sf::RenderTarget& target) const {
+        target.draw(pathLines);
+        target.draw(sprites, sf::RenderStates(&texture));
+        target.draw(rings);
     }
 };
 
-EntityGrid entityGrid(gridSize);
-
-bool wouldCollideWithWall(const sf::Vector2f& pos, float radius) { // waffle collision helper
-    int centerGx = static_cast<int>(std::floor(pos.x / gridSize));
-    int centerGy = static_cast<int>(std::floor(pos.y / gridSize));
-
-    // Check 3x3 surrounding grid cells
-    for (int x = -1; x <= 1; ++x) {
-        for (int y = -1; y <= 1; ++y) {
-            int targetGx = centerGx + x;
-            int targetGy = centerGy + y;
+// Every shot in flight as one triangle batch: a streak along its velocity, tinted by team. Shots
+// have no identity across snapshots, so instead of interpolating they are drawn where they were
+// (1 - alpha) ticks before curr, which keeps them in step with the interpolated waffles.
+class ProjectileRenderer {
+private:
+    static constexpr float streakLength = 36.f;
+    static constexpr float streakWidth = 5.f;
 
-            if (isWall(targetGx, targetGy)) {
-                float wallX = targetGx * gridSize;
-                float wallY = targetGy * gridSize;
+    sf::VertexArray streaks{ sf::PrimitiveType::Triangles };
 
-                float closestX = std::max(wallX, std::min(pos.x, wallX + gridSize));
-                float closestY = std::max(wallY, std::min(pos.y, wallY + gridSize));
+public:
+    void build(const WaffleSnapshot& curr, float alpha) {
+        streaks.clear();
+        for (const WaffleSnapshot::Shot& shot : curr.shots) {
+            float length = std::sqrt(shot.velocity.x * shot.velocity.x + shot.velocity.y * shot.velocity.y);
+            if (length <= 0.f) continue;
+            sf::Vector2f dir = shot.velocity / length;
+            sf::Vector2f side(-dir.y * streakWidth * 0.5f, dir.x * streakWidth * 0.5f);
+            sf::Vector2f head = shot.pos - shot.velocity * ((1.f - alpha) * simTickSeconds);
+            sf::Vector2f tail = head - dir * streakLength;
+
+            sf::Color headColor = teamTint(shot.team);
+            sf::Color tailColor(headColor.r, headColor.g, headColor.b, 0);
+            sf::Vertex a{ head + side, headColor };
+            sf::Vertex b{ head - side, headColor };
+            sf::Vertex c{ tail - side, tailColor };
+            sf::Vertex d{ tail + side, tailColor };
+            streaks.append(a);
+            streaks.append(b);
+            streaks.append(c);
+            streaks.append(a);
+            streaks.append(c);
+            streaks.append(d);
+        }
+    }
 
-                sf::Vector2f closestPoint(closestX, closestY);
-                sf::Vector2f diff = pos - closestPoint;
+    void draw(sf::RenderTarget& target) const {
+        target.draw(streaks);
+    }
+};
 
-                float distanceSq = diff.x * diff.x + diff.y * diff.y;
+// Profiler overlay, F1 toggles it and F2 writes the rings out as a Chrome trace. Zone events are
+// drained every frame whether or not it is shown; the last historyFrames frames are kept for a
+// frame-time graph and, per zone, the average and worst milliseconds per frame. Zone times include
+// their nested zones, and zones from other threads count towards the frame that drained them.
+// Text needs one of fontPaths, without it only the graph and the bars are drawn.
+class ProfilerOverlay {
+private:
+    static constexpr size_t historyFrames = 240;
+    static constexpr size_t averageFrames = 60;
+    static constexpr float graphHeight = 120.f;
+    static constexpr float graphMsScale = 4.f;  // pixels per ms in the frame graph
+    static constexpr float barMsScale = 40.f;   // pixels per ms in the zone bars
+    static constexpr float budgetMs = 1000.f / 60.f;
+    static constexpr float rowHeight = 18.f;
+    static constexpr float textWidth = 560.f;   // zone text column, bars start after it
+    static constexpr float barWidth = 200.f;
+
+    struct ZoneHistory {
+        std::string_view name; // zone names are literals, the view never dangles
+        sf::Color color;
+        std::array<float, historyFrames> ms{};
+        std::array<uint32_t, historyFrames> calls{};
+    };
 
-                if (distanceSq < radius * radius) {
-                    return true; 
-                }
-            }
-        }
+    std::vector<ZoneHistory> zones; // in order of first appearance
+    std::unordered_map<std::string_view, size_t> zoneIndex;
+    std::array<float, historyFrames> frameMs{};
+    size_t frame = 0; // slot of the newest frame
+
+    ProfileReader reader;
+    std::vector<ProfileEvent> events;
+    sf::VertexArray bars{ sf::PrimitiveType::Triangles };
+    sf::Font font;
+    std::optional<sf::Text> text;
+
+    static sf::Color zoneColor(size_t k) {
+        static const sf::Color palette[] = {
+            { 230, 90, 70 }, { 90, 170, 240 }, { 250, 200, 60 }, { 120, 210, 110 },
+            { 200, 120, 230 }, { 70, 210, 200 }, { 250, 140, 40 }, { 180, 180, 180 },
+        };
+        return palette[k % std::size(palette)];
     }
-    return false;
-}
-
-void waffleCollisions(std::vector<Waffle>& waffles, float waffleRadius) {
-    for (size_t i = 0; i < waffles.size(); ++i) {
-        for (size_t j = i + 1; j < waffles.size(); ++j) {
-            sf::Vector2f diff = waffles[j].pos - waffles[i].pos;
-            float distance = std::sqrt(diff.x * diff.x + diff.y * diff.y);
-            float minDistance = waffleRadius * 2.f;
-
-            if (distance < minDistance && distance > 0.01f) {
-                sf::Vector2f direction(diff.x / distance, diff.y / distance);
-                float overlap = minDistance - distance;
-
-                bool iMoving = waffles[i].isSelected;
-                bool jMoving = waffles[j].isSelected;
-
-                sf::Vector2f pushI, pushJ;
-                sf::Vector2f correction = 1.67f * direction * overlap;
-                if (iMoving && !jMoving) {
-                    pushJ = correction * 0.8f;
-                    pushI = correction * -0.2f;
-                }
-                else if (jMoving && !iMoving) {
-                    pushI = correction * -0.8f;
-                    pushJ = correction * 0.2f;
-                }
-                else {
-                    pushI = correction / -2.f;
-                    pushJ = correction / 2.f;
-                }
 
-                sf::Vector2f newPosI = waffles[i].pos + pushI;
-                sf::Vector2f newPosJ = waffles[j].pos + pushJ;
+    void appendRect(float x, float y, float w, float h, sf::Color color) {
+        sf::Vertex tl{ { x, y }, color };
+        sf::Vertex tr{ { x + w, y }, color };
+        sf::Vertex br{ { x + w, y + h }, color };
+        sf::Vertex bl{ { x, y + h }, color };
+        bars.append(tl);
+        bars.append(tr);
+        bars.append(br);
+        bars.append(tl);
+        bars.append(br);
+        bars.append(bl);
+    }
 
-                bool iCanMove = !wouldCollideWithWall(newPosI, waffleRadius);
-                bool jCanMove = !wouldCollideWithWall(newPosJ, waffleRadius);
+    void drawLine(sf::RenderTarget& target, float x, float y, const char* line) {
+        if (!text) return;
+        text->setString(line);
+        text->setPosition({ x, y });
+        target.draw(*text);
+    }
 
-                if (iCanMove && jCanMove) {
-                    // Both move
-                    waffles[i].pos = newPosI;
-                    waffles[j].pos = newPosJ;
-                }
-                else if (iCanMove && !jCanMove) {
-                    waffles[i].pos = waffles[i].pos + -correction;
-                }
-                else if (!iCanMove && jCanMove) {
-                    waffles[j].pos = waffles[j].pos + correction;
-                }
+public:
+    bool visible = false;
+
+    ProfilerOverlay() {
+        const char* fontPaths[] = {
+            "font.ttf",
+            "C:/Windows/Fonts/consola.ttf",
+            "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+            "/System/Library/Fonts/Menlo.ttc",
+        };
+        for (const char* path : fontPaths) {
+            if (font.openFromFile(path)) {
+                text.emplace(font, "", 13);
+                text->setFillColor(sf::Color::White);
+                break;
             }
         }
     }
-}
-
-void wallCollisions(std::vector<Waffle>& waffles) {
-    for (auto& w : waffles) {
-        // find current grid cell 
-        int centerGx = static_cast<int>(std::floor(w.pos.x / gridSize));
-        int centerGy = static_cast<int>(std::floor(w.pos.y / gridSize));
 
-        // Check surrounding 3x3 for walls
-        for (int x = -1; x <= 1; ++x) {
-            for (int y = -1; y <= 1; ++y) {
-                int targetGx = centerGx + x;
-                int targetGy = centerGy + y;
-
-                if (isWall(targetGx, targetGy)) {
-                    float wallX = targetGx * gridSize;
-                    float wallY = targetGy * gridSize;
-
-                    // closest point on the square to the circle center
-                    float closestX = std::max(wallX, std::min(w.pos.x, wallX + gridSize));
-                    float closestY = std::max(wallY, std::min(w.pos.y, wallY + gridSize));
-
-                    sf::Vector2f closestPoint(closestX, closestY);
-                    sf::Vector2f diff = w.pos - closestPoint;
-
-                    float distanceSq = diff.x * diff.x + diff.y * diff.y;
-
-                    if (distanceSq < collisionRadius * collisionRadius) {
-                        float distance = std::sqrt(distanceSq);
+    // call once per frame with the frame's duration
+    void update(float deltaTime) {
+        frame = (frame + 1) % historyFrames;
+        frameMs[frame] = deltaTime * 1000.f;
+        for (ZoneHistory& zone : zones) {
+            zone.ms[frame] = 0.f;
+            zone.calls[frame] = 0;
+        }
 
-                        // Prevent division by zero
-                        if (distance > 0.00000001f) {
-                            sf::Vector2f direction(diff.x / distance, diff.y / distance);
-                            float overlap = collisionRadius - distance;
+        events.clear();
+        reader.read(events);
+        for (const ProfileEvent& e : events) {
+            auto [it, added] = zoneIndex.try_emplace(std::string_view(e.zone), zones.size());
+            if (added) zones.push_back({ e.zone, zoneColor(zones.size()) });
+            ZoneHistory& zone = zones[it->second];
+            zone.ms[frame] += static_cast<float>(e.end - e.begin) * 1e-6f;
+            ++zone.calls[frame];
+        }
+    }
 
-                            // Hard push out of the wall
-                            w.pos += direction * overlap;
-                        }
-                    }
+    // screen space, the target's view is restored afterwards
+    void draw(sf::RenderTarget& target) {
+        if (!visible) return;
+        sf::View worldView = target.getView();
+        target.setView(target.getDefaultView());
+
+        const float left = 12.f, top = 12.f;
+        const float graphWidth = historyFrames * 2.f;
+        const float panelWidth = std::max(graphWidth, 16.f + textWidth + barWidth) + 12.f;
+        float rowsTop = top + graphHeight + 2.f * rowHeight;
+        float panelHeight = rowsTop - top + zones.size() * rowHeight + 8.f;
+
+        bars.clear();
+        appendRect(left - 6.f, top - 6.f, panelWidth, panelHeight, sf::Color(0, 0, 0, 170));
+
+        // frame graph, oldest frame on the left, with the 60 fps budget as a line
+        float frameAvg = 0.f, frameWorst = 0.f;
+        for (size_t k = 0; k < historyFrames; ++k) {
+            float ms = frameMs[(frame + 1 + k) % historyFrames];
+            float h = std::min(ms * graphMsScale, graphHeight);
+            appendRect(left + k * 2.f, top + graphHeight - h, 2.f, h,
+                ms > budgetMs ? sf::Color(240, 80, 60) : sf::Color(110, 220, 110));
+            frameWorst = std::max(frameWorst, ms);
+        }
+        for (size_t k = 0; k < averageFrames; ++k) {
+            frameAvg += frameMs[(frame + historyFrames - k) % historyFrames] / averageFrames;
+        }
+        appendRect(left, top + graphHeight - budgetMs * graphMsScale, graphWidth, 1.f, sf::Color(255, 255, 255, 140));
+
+        // zone bars, average over the last averageFrames frames
+        for (size_t z = 0; z < zones.size(); ++z) {
+            const ZoneHistory& zone = zones[z];
+            float avg = 0.f;
+            for (size_t k = 0; k < averageFrames; ++k) {
+                avg += zone.ms[(frame + historyFrames - k) % historyFrames] / averageFrames;
+            }
+            float y = rowsTop + z * rowHeight;
+            appendRect(left, y + 3.f, 10.f, 10.f, zone.color);
+            appendRect(left + 16.f + textWidth, y + 5.f, std::min(avg * barMsScale, barWidth), 6.f, zone.color);
+        }
+        target.draw(bars);
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "frame %6.2f ms avg %6.2f ms worst   F1 hide, F2 trace", frameAvg, frameWorst);
+        drawLine(target, left, top + graphHeight + 4.f, line);
+        for (size_t z = 0; z < zones.size(); ++z) {
+            const ZoneHistory& zone = zones[z];
+            float avg = 0.f, worst = 0.f, calls = 0.f;
+            for (size_t k = 0; k < historyFrames; ++k) {
+                size_t slot = (frame + historyFrames - k) % historyFrames;
+                if (k < averageFrames) {
+                    avg += zone.ms[slot] / averageFrames;
+                    calls += static_cast<float>(zone.calls[slot]) / averageFrames;
                 }
+                worst = std::max(worst, zone.ms[slot]);
             }
+            std::snprintf(line, sizeof(line), "%-20.*s %7.3f ms avg %7.3f ms worst %7.1f calls",
+                static_cast<int>(zone.name.size()), zone.name.data(), avg, worst, calls);
+            drawLine(target, left + 16.f, rowsTop + z * rowHeight, line);
         }
+
+        target.setView(worldView);
     }
-}
+};
 
 int main()
 {
@@ -371,19 +456,64 @@ int main()
     if (!waffleTexture.loadFromFile("waffle.png")) {
         return -1;
     }
+    WaffleBatchRenderer waffleRenderer(waffleTexture);
+    ProjectileRenderer projectileRenderer;
+    TerrainChunkCache terrainCache;
+    ProfilerOverlay profilerOverlay;
+    profileThreadName("render");
+
+    Simulation sim;
+    sim.addWaffle(sf::Vector2f(0.f, 0.f));
+    sim.addWaffle(sf::Vector2f(250.f, 0.f));
+    sim.addWaffle(sf::Vector2f(-250.f, 0.f));
+    sim.addWaffle(sf::Vector2f(0.f, 250.f));
+    sim.addWaffle(sf::Vector2f(0.f, -250.f));
+    sim.addWaffle(sf::Vector2f(0.f, 0.f));
+    sim.addWaffle(sf::Vector2f(250.f, 0.f));
+    sim.addWaffle(sf::Vector2f(-250.f, 0.f));
+    sim.addWaffle(sf::Vector2f(0.f, 250.f));
+    sim.addWaffle(sf::Vector2f(0.f, -250.f));
+    sim.addWaffle(sf::Vector2f(0.f, 0.f));
+    // the other team, to shoot at
+    sim.addWaffle(sf::Vector2f(1500.f, -250.f), 1);
+    sim.addWaffle(sf::Vector2f(1500.f, 0.f), 1);
+    sim.addWaffle(sf::Vector2f(1500.f, 250.f), 1);
+    sim.addWaffle(sf::Vector2f(1750.f, -125.f), 1);
+    sim.addWaffle(sf::Vector2f(1750.f, 125.f), 1);
+    sim.start();
+
+    // F5 starts a capture: the state now goes to a save, every command after it to the log, and the
+    // log is written when F5 is pressed again or the window closes. headless replay runs it.
+    const std::string capturePath = "waffles_capture";
+    CommandLog captureLog;
+    bool capturing = false;
+    auto toggleCapture = [&] {
+        sim.stop(); // save and recordCommands need the sim thread parked
+        if (!capturing) {
+            capturing = sim.save(capturePath + ".wsave");
+            if (capturing) sim.recordCommands(&captureLog);
+            else std::cout << "could not write " << capturePath << ".wsave\n";
+        }
+        else {
+            sim.recordCommands(nullptr);
+            capturing = false;
+            if (captureLog.write(capturePath + ".wlog")) {
+                std::cout << "capture written to " << capturePath << ".wsave/.wlog, "
+                    << captureLog.endTick - captureLog.startTick << " ticks\n";
+            }
+            else {
+                std::cout << "could not write " << capturePath << ".wlog\n";
+            }
+        }
+        sim.start();
+    };
 
-    std::vector<Waffle> waffles;
-    waffles.emplace_back(sf::Vector2f(0.f, 0.f));
-    waffles.emplace_back(sf::Vector2f(250.f, 0.f));
-    waffles.emplace_back(sf::Vector2f(-250.f, 0.f));
-    waffles.emplace_back(sf::Vector2f(0.f, 250.f));
-    waffles.emplace_back(sf::Vector2f(0.f, -250.f));
-    waffles.emplace_back(sf::Vector2f(0.f, 0.f));
-    waffles.emplace_back(sf::Vector2f(250.f, 0.f));
-    waffles.emplace_back(sf::Vector2f(-250.f, 0.f));
-    waffles.emplace_back(sf::Vector2f(0.f, 250.f));
-    waffles.emplace_back(sf::Vector2f(0.f, -250.f));
-    waffles.emplace_back(sf::Vector2f(0.f, 0.f));
+    // the two newest ticks, rendered in between
+    WaffleSnapshot prevSnapshot;
+    WaffleSnapshot currSnapshot;
+    WaffleSnapshot incomingSnapshot;
+    SnapshotPicker picker; // over currSnapshot
+    std::vector<size_t> preview;
 
     // Selection state
     bool isDragging = false;
@@ -398,12 +528,33 @@ int main()
     while (window.isOpen())
     {
         float deltaTime = clock.restart().asSeconds();
+        profilerOverlay.update(deltaTime);
 
+        PROFILE_ZONE("frame");
         while (auto event = window.pollEvent())
         {
             if (event->is<sf::Event::Closed>())
                 window.close();
 
+            // F1 profiler overlay, F2 Chrome trace of the last few seconds, F5 capture
+            if (const auto* key = event->getIf<sf::Event::KeyPressed>()) {
+                if (key->code == sf::Keyboard::Key::F1) {
+                    profilerOverlay.visible = !profilerOverlay.visible;
+                }
+                else if (key->code == sf::Keyboard::Key::F2) {
+                    const char* tracePath = "waffles_trace.json";
+                    if (exportChromeTrace(tracePath)) std::cout << "profiler trace written to " << tracePath << "\n";
+                }
+                else if (key->code == sf::Keyboard::Key::F5) {
+                    toggleCapture();
+                }
+                // Space - selected waffles shoot at the cursor, key repeat keeps them firing
+                else if (key->code == sf::Keyboard::Key::Space) {
+                    sf::Vector2f aim = window.mapPixelToCoords(sf::Mouse::getPosition(window));
+                    sim.pushCommand({ SimCommandType::Fire, false, aim, aim });
+                }
+            }
+
             // Left mouse button - selection
             if (const auto* mouseButton = event->getIf<sf::Event::MouseButtonPressed>()) {
                 if (mouseButton->button == sf::Mouse::Button::Left) {
@@ -416,43 +567,8 @@ int main()
                 if (mouseButton->button == sf::Mouse::Button::Left && isDragging) {
                     isDragging = false;
                     sf::Vector2f dragEnd = window.mapPixelToCoords(mouseButton->position);
-
-                    // selection rectangle
-                    float minX = std::min(dragStart.x, dragEnd.x);
-                    float maxX = std::max(dragStart.x, dragEnd.x);
-                    float minY = std::min(dragStart.y, dragEnd.y);
-                    float maxY = std::max(dragStart.y, dragEnd.y);
-
-                    // Check if click (small drag area)
-                    bool isClick = std::abs(dragEnd.x - dragStart.x) < 5.f &&
-                        std::abs(dragEnd.y - dragStart.y) < 5.f;
-
-                    // Clear prev selection if not holding shift
-                    if (!sf::Keyboard::isKeyPressed(sf::Keyboard::Key::LShift)) {
-                        for (auto& w : waffles) {
-                            w.isSelected = false;
-                        }
-                    }
-
-                    for (auto& w : waffles) {
-                        if (isClick) {
-                            // Click selection
-                            float dx = w.pos.x - dragStart.x;
-                            float dy = w.pos.y - dragStart.y;
-                            float dist = std::sqrt(dx * dx + dy * dy);
-                            if (dist <= selectionRadius) {
-                                w.isSelected = !w.isSelected;
-                                break; // Only select one waffle on click
-                            }
-                        }
-                        else {
-                            // Box selection
-                            if (w.pos.x >= minX && w.pos.x <= maxX &&
-                                w.pos.y >= minY && w.pos.y <= maxY) {
-                                w.isSelected = true;
-                            }
-                        }
-                    }
+                    bool additive = sf::Keyboard::isKeyPressed(sf::Keyboard::Key::LShift);
+                    sim.pushCommand({ SimCommandType::Select, additive, dragStart, dragEnd });
                 }
             }
 
@@ -460,18 +576,16 @@ int main()
             if (const auto* mouseButton = event->getIf<sf::Event::MouseButtonPressed>()) {
                 if (mouseButton->button == sf::Mouse::Button::Right) {
                     sf::Vector2f clickPos = window.mapPixelToCoords(mouseButton->position);
-                    for (auto& w : waffles) {
-                        if (w.isSelected) {
-                            std::deque<sf::Vector2f> path = findPathAstar(w.pos, clickPos);
-                            if (!path.empty()) {
-                                w.path = std::move(path);
-                                w.targetPos = w.path.front();
-                            }
-                            else {
-                                w.targetPos = clickPos;
-                            }
-                        }
-                    }
+                    sim.pushCommand({ SimCommandType::Move, false, clickPos, clickPos });
+                }
+            }
+
+            // Middle click - build a wall on the cell under the cursor, or clear the one there
+            if (const auto* mouseButton = event->getIf<sf::Event::MouseButtonPressed>()) {
+                if (mouseButton->button == sf::Mouse::Button::Middle) {
+                    sf::Vector2f cell = window.mapPixelToCoords(mouseButton->position);
+                    bool wall = isWall(static_cast<int>(std::floor(cell.x / gridSize)), static_cast<int>(std::floor(cell.y / gridSize)));
+                    sim.pushCommand({ wall ? SimCommandType::ClearWall : SimCommandType::BuildWall, false, cell, cell });
                 }
             }
 
@@ -504,55 +618,21 @@ int main()
 
         camera.move(cameraMove);
         window.setView(camera);
-        // Movement loop
-        for (auto& w : waffles) {
-            if (!w.path.empty()) {
-                w.targetPos = w.path.front();
 
-                sf::Vector2f direction = w.targetPos - w.pos;
-                float distance = std::sqrt(direction.x * direction.x + direction.y * direction.y);
-
-                if (distance > 67.f) {
-                    direction = sf::Vector2f(direction.x / distance, direction.y / distance);
-                    sf::Vector2f movement = direction * speed * deltaTime;
-
-                    if (std::sqrt(movement.x * movement.x + movement.y * movement.y) >= distance) {
-                        w.pos = w.targetPos;
-                        w.path.pop_front();
-                    }
-                    else {
-                        w.pos += movement;
-                    }
-                }
-                else {
-                    w.path.pop_front();
-                }
-            }
-            else {
-                sf::Vector2f direction = w.targetPos - w.pos;
-                float distance = std::sqrt(direction.x * direction.x + direction.y * direction.y);
-
-                if (distance > 67.f) {
-                    direction = sf::Vector2f(direction.x / distance, direction.y / distance);
-                    sf::Vector2f movement = direction * speed * deltaTime;
-
-                    if (std::sqrt(movement.x * movement.x + movement.y * movement.y) >= distance) {
-                        w.pos = w.targetPos;
-                    }
-                    else {
-                        w.pos += movement;
-                    }
-                }
-            }
+        // Newest tick from the sim thread
+        if (sim.takeSnapshot(incomingSnapshot)) {
+            std::swap(prevSnapshot, currSnapshot);
+            std::swap(currSnapshot, incomingSnapshot);
+            picker.rebuild(currSnapshot);
         }
-
-        waffleCollisions(waffles, collisionRadius);
-        wallCollisions(waffles);
+        float alpha = std::chrono::duration<float>(std::chrono::steady_clock::now() - currSnapshot.time).count() / simTickSeconds;
+        alpha = std::clamp(alpha, 0.f, 1.f);
 
         window.clear(sf::Color::Green);
 
         sf::Vector2f cameraCenter = camera.getCenter();
         sf::Vector2f cameraSize = camera.getSize();
+        sim.setView(sf::FloatRect(cameraCenter - cameraSize / 2.f, cameraSize));
 
         // Calc visible grid cells
         int startGx = static_cast<int>(std::floor((cameraCenter.x - cameraSize.x / 2.f) / gridSize));
@@ -560,26 +640,10 @@ int main()
         int startGy = static_cast<int>(std::floor((cameraCenter.y - cameraSize.y / 2.f) / gridSize));
         int endGy = static_cast<int>(std::ceil((cameraCenter.y + cameraSize.y / 2.f) / gridSize));
 
-        sf::RectangleShape cellShape;
-        cellShape.setSize({ gridSize, gridSize });
-
         // Draw grid
-        for (int x = startGx; x < endGx; ++x) {
-            for (int y = startGy; y < endGy; ++y) {
-                cellShape.setPosition(sf::Vector2(x * gridSize, y * gridSize));
-
-                if (isWall(x, y)) {
-                    cellShape.setFillColor(sf::Color::Black);
-                    cellShape.setOutlineThickness(0);
-                    window.draw(cellShape);
-                }
-                else {
-                    cellShape.setFillColor(sf::Color::Transparent);
-                    cellShape.setOutlineColor(sf::Color(0, 150, 0));
-                    cellShape.setOutlineThickness(-2.f * zoomLevel);
-                    window.draw(cellShape);
-                }
-            }
+        {
+            PROFILE_ZONE("terrain");
+            terrainCache.draw(window, startGx, endGx, startGy, endGy, zoomLevel);
         }
 
         // Draw selection box while dragging
@@ -594,38 +658,40 @@ int main()
             window.draw(selectionBox);
         }
 
-        //Render loop 
-        for (const auto& w : waffles) {
-            // Draw A* path if exists
-            if (!w.path.empty()) {
-                for (size_t i = 0; i < w.path.size() - 1; ++i) {
-                    sf::Vertex line[] = {
-                        sf::Vertex(w.path[i], sf::Color::Red),
-                        sf::Vertex(w.path[i + 1], sf::Color::Red)
-                    };
-                    window.draw(line, 2, sf::PrimitiveType::Lines);
-                }
-            }
+        // what releasing the mouse now would select, or the waffle a click would pick
+        {
+            PROFILE_ZONE("selection preview");
+            sf::Vector2f cursor = window.mapPixelToCoords(sf::Mouse::getPosition(window));
+            picker.pick(isDragging ? dragStart : cursor, cursor, preview);
+        }
 
-            sf::Sprite waffleSprite(waffleTexture);
-            waffleSprite.setScale(sf::Vector2f(0.25f, 0.25f));
-            sf::FloatRect bounds = waffleSprite.getLocalBounds();
-            waffleSprite.setOrigin(bounds.size / 2.f);
-            waffleSprite.setPosition(w.pos);
-            window.draw(waffleSprite);
-
-            if (w.isSelected) {
-                sf::CircleShape selectionCircle(selectionRadius);
-                selectionCircle.setOrigin(sf::Vector2(selectionRadius, selectionRadius));
-                selectionCircle.setPosition(w.pos);
-                selectionCircle.setFillColor(sf::Color::Transparent);
-                selectionCircle.setOutlineColor(sf::Color::Blue);
-                selectionCircle.setOutlineThickness(5.f * zoomLevel);
-                window.draw(selectionCircle);
-            }
+        //Render loop 
+        {
+            PROFILE_ZONE("waffle build");
+            waffleRenderer.build(prevSnapshot, currSnapshot, alpha, zoomLevel, preview);
+        }
+        {
+            PROFILE_ZONE("waffle draw");
+            waffleRenderer.draw(window);
+        }
+        {
+            PROFILE_ZONE("projectiles");
+            projectileRenderer.build(currSnapshot, alpha);
+            projectileRenderer.draw(window);
+        }
+        profilerOverlay.draw(window);
+        {
+            PROFILE_ZONE("display");
+            window.display();
         }
-        window.display();
     }
+    if (capturing) toggleCapture();
+    sim.stop();
+
+    PathCacheStats cacheStats = pathCacheStats();
+    std::cout << "path cache: " << cacheStats.hits << " hits, " << cacheStats.subPathHits << " sub-path hits, "
+        << cacheStats.misses << " misses, " << cacheStats.evictions << " evictions, "
+        << cacheStats.invalidations << " invalidations\n";
 
     return 0;
 }
\ No newline at end of file